@@ -0,0 +1,267 @@
+// ***************************************************************
+// SPDX-FileCopyrightText: Copyright 2024 Ricardo Montañana Gómez
+// SPDX-FileType: SOURCE
+// SPDX-License-Identifier: MIT
+// ***************************************************************
+
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+#include "folding.hpp"
+
+// Every heap allocation made through operator new is counted so each benchmark can report
+// the bytes allocated per iteration. Tensors use their own allocator and are not counted.
+static std::atomic<size_t> allocated_bytes{ 0 };
+
+void* operator new(std::size_t size)
+{
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+enum Distribution { BALANCED = 0, IMBALANCED = 1 };
+
+// Labels drawn with a fixed seed. Balanced labels are uniform over the classes, imbalanced ones
+// put half of the remaining samples in each successive class, so the last classes are very rare.
+static const std::vector<int>& labels(int n, int num_classes, int distribution)
+{
+    static auto key = std::tuple<int, int, int>(-1, -1, -1);
+    static auto y = std::vector<int>();
+    if (key == std::make_tuple(n, num_classes, distribution)) {
+        return y;
+    }
+    key = std::make_tuple(n, num_classes, distribution);
+    y.assign(n, 0);
+    auto rng = std::mt19937(271);
+    auto uniform = std::uniform_int_distribution<int>(0, num_classes - 1);
+    auto geometric = std::geometric_distribution<int>(0.5);
+    for (auto& label : y) {
+        label = distribution == BALANCED ? uniform(rng) : std::min(geometric(rng), num_classes - 1);
+    }
+    return y;
+}
+
+static void report(benchmark::State& state, int64_t samples, size_t bytes_before)
+{
+    state.counters["samples/s"] = benchmark::Counter(state.iterations() * samples, benchmark::Counter::kIsRate);
+    state.counters["bytes_allocated"] = benchmark::Counter((allocated_bytes.load() - bytes_before) / state.iterations());
+}
+
+static void BM_GroupByClassMap(benchmark::State& state)
+{
+    const auto& y = labels(state.range(0), state.range(1), BALANCED);
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        auto groups = folding::groupByClassMap(y.data(), y.size());
+        benchmark::DoNotOptimize(groups.indices.data());
+    }
+    report(state, state.range(0), bytes_before);
+}
+
+static void BM_GroupByClassCounting(benchmark::State& state)
+{
+    const auto& y = labels(state.range(0), state.range(1), BALANCED);
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        auto groups = folding::groupByClassCounting(y.data(), y.size(), state.range(1));
+        benchmark::DoNotOptimize(groups.indices.data());
+    }
+    report(state, state.range(0), bytes_before);
+}
+
+static void BM_KFoldBuild(benchmark::State& state)
+{
+    int n = state.range(0), k = state.range(1);
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        folding::KFold kfold(k, n, 19);
+        benchmark::DoNotOptimize(kfold.getPermutation().data());
+    }
+    report(state, n, bytes_before);
+}
+
+static void BM_StratifiedKFoldBuild(benchmark::State& state)
+{
+    int n = state.range(0), k = state.range(1);
+    const auto& y = labels(n, 20, state.range(2));
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        folding::StratifiedKFold stratified_kfold(k, y, 17);
+        benchmark::DoNotOptimize(stratified_kfold.getPermutation().data());
+    }
+    report(state, n, bytes_before);
+}
+
+static void BM_StratifiedKFoldBuildTensor(benchmark::State& state)
+{
+    int n = state.range(0), k = state.range(1);
+    auto y = torch::tensor(labels(n, 20, state.range(2)), torch::kInt32);
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        folding::StratifiedKFold stratified_kfold(k, y, 17);
+        benchmark::DoNotOptimize(stratified_kfold.getPermutation().data());
+    }
+    report(state, n, bytes_before);
+}
+
+// Same as above with int64 labels, read without converting them
+static void BM_StratifiedKFoldBuildTensorInt64(benchmark::State& state)
+{
+    int n = state.range(0), k = state.range(1);
+    auto y = torch::tensor(labels(n, 20, state.range(2)), torch::kInt64);
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        folding::StratifiedKFold stratified_kfold(k, y, 17);
+        benchmark::DoNotOptimize(stratified_kfold.getPermutation().data());
+    }
+    report(state, n, bytes_before);
+}
+
+// Retrieve every fold of an already built object, as a cross validation loop does
+static void sweep(benchmark::State& state, folding::Fold& fold_object, int n)
+{
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        for (int fold = 0; fold < fold_object.getNumberOfFolds(); ++fold) {
+            auto [train, test] = fold_object.getFold(fold);
+            benchmark::DoNotOptimize(train.data());
+            benchmark::DoNotOptimize(test.data());
+        }
+    }
+    report(state, int64_t(n) * fold_object.getNumberOfFolds(), bytes_before);
+}
+
+static void BM_KFoldSweep(benchmark::State& state)
+{
+    folding::KFold kfold(state.range(1), state.range(0), 19);
+    sweep(state, kfold, state.range(0));
+}
+
+static void BM_StratifiedKFoldSweep(benchmark::State& state)
+{
+    folding::StratifiedKFold stratified_kfold(state.range(1), labels(state.range(0), 20, state.range(2)), 17);
+    sweep(state, stratified_kfold, state.range(0));
+}
+
+static void BM_StratifiedKFoldSweepTensor(benchmark::State& state)
+{
+    auto y = torch::tensor(labels(state.range(0), 20, state.range(2)), torch::kInt32);
+    folding::StratifiedKFold stratified_kfold(state.range(1), y, 17);
+    sweep(state, stratified_kfold, state.range(0));
+}
+
+// Same sweep through the range interface, which reuses its buffers from fold to fold
+static void BM_StratifiedKFoldIterate(benchmark::State& state)
+{
+    folding::StratifiedKFold stratified_kfold(state.range(1), labels(state.range(0), 20, state.range(2)), 17);
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        for (const auto& split : stratified_kfold) {
+            benchmark::DoNotOptimize(split.train.data());
+            benchmark::DoNotOptimize(split.test.data());
+        }
+    }
+    report(state, state.range(0) * state.range(1), bytes_before);
+}
+
+// Test masks of every fold, as packed bits written into a reused buffer and derived from the fold ids
+static void BM_StratifiedKFoldMask(benchmark::State& state)
+{
+    folding::StratifiedKFold stratified_kfold(state.range(1), labels(state.range(0), 20, state.range(2)), 17);
+    auto mask = std::vector<uint64_t>();
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        for (int fold = 0; fold < stratified_kfold.getNumberOfFolds(); ++fold) {
+            stratified_kfold.getFoldMask(fold, mask);
+            benchmark::DoNotOptimize(mask.data());
+        }
+    }
+    report(state, state.range(0) * state.range(1), bytes_before);
+}
+
+static void BM_StratifiedKFoldMaskFromIds(benchmark::State& state)
+{
+    folding::StratifiedKFold stratified_kfold(state.range(1), labels(state.range(0), 20, state.range(2)), 17);
+    auto fold_ids = stratified_kfold.getFoldIds();
+    auto mask = std::vector<uint64_t>((fold_ids.size() + 63) / 64);
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        for (int fold = 0; fold < stratified_kfold.getNumberOfFolds(); ++fold) {
+            folding::maskFromFoldIds(fold_ids.data(), fold_ids.size(), fold, mask.data());
+            benchmark::DoNotOptimize(mask.data());
+        }
+    }
+    report(state, state.range(0) * state.range(1), bytes_before);
+}
+
+// Test sets of many Monte Carlo splits with a 1% test fraction, through the views
+static void shuffleSweep(benchmark::State& state, folding::Fold& fold_object, int64_t test_size)
+{
+    fold_object.getFoldView(0); // The arrangement of each thread is copied on its first split
+    auto bytes_before = allocated_bytes.load();
+    for (auto _ : state) {
+        for (int split = 0; split < fold_object.getNumberOfFolds(); ++split) {
+            benchmark::DoNotOptimize(fold_object.getFoldView(split).test.data());
+        }
+    }
+    report(state, test_size * fold_object.getNumberOfFolds(), bytes_before);
+}
+
+static void BM_ShuffleSplitSweep(benchmark::State& state)
+{
+    folding::ShuffleSplit shuffle_split(state.range(1), state.range(0), 0.01, 19);
+    shuffleSweep(state, shuffle_split, shuffle_split.getTestSize());
+}
+
+static void BM_StratifiedShuffleSplitSweep(benchmark::State& state)
+{
+    folding::StratifiedShuffleSplit stratified_shuffle_split(state.range(1), labels(state.range(0), 20, state.range(2)), 0.01, 17);
+    shuffleSweep(state, stratified_shuffle_split, stratified_shuffle_split.getTestSize());
+}
+
+static const std::vector<int64_t> sizes = { 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+static const std::vector<int64_t> folds = { 3, 5, 10, 20 };
+static const std::vector<int64_t> distributions = { BALANCED, IMBALANCED };
+
+static void GroupingArguments(benchmark::internal::Benchmark* bench)
+{
+    bench->ArgNames({ "n", "classes" })->Unit(benchmark::kMillisecond);
+    bench->ArgsProduct({ { 10000, 1000000, 10000000 }, { 2, 20, 200 } });
+}
+static void KFoldArguments(benchmark::internal::Benchmark* bench)
+{
+    bench->ArgNames({ "n", "k" })->Unit(benchmark::kMillisecond)->ArgsProduct({ sizes, folds });
+}
+static void ShuffleArguments(benchmark::internal::Benchmark* bench)
+{
+    bench->ArgNames({ "n", "splits", "imbalanced" })->Unit(benchmark::kMillisecond)->ArgsProduct({ { 100000, 1000000, 20000000 }, { 100, 500 }, distributions });
+}
+static void StratifiedArguments(benchmark::internal::Benchmark* bench)
+{
+    bench->ArgNames({ "n", "k", "imbalanced" })->Unit(benchmark::kMillisecond)->ArgsProduct({ sizes, folds, distributions });
+}
+
+BENCHMARK(BM_GroupByClassMap)->Apply(GroupingArguments);
+BENCHMARK(BM_GroupByClassCounting)->Apply(GroupingArguments);
+BENCHMARK(BM_KFoldBuild)->Apply(KFoldArguments);
+BENCHMARK(BM_KFoldSweep)->Apply(KFoldArguments);
+BENCHMARK(BM_StratifiedKFoldBuild)->Apply(StratifiedArguments);
+BENCHMARK(BM_StratifiedKFoldBuildTensor)->Apply(StratifiedArguments);
+BENCHMARK(BM_StratifiedKFoldBuildTensorInt64)->Apply(StratifiedArguments);
+BENCHMARK(BM_StratifiedKFoldSweep)->Apply(StratifiedArguments);
+BENCHMARK(BM_StratifiedKFoldSweepTensor)->Apply(StratifiedArguments);
+BENCHMARK(BM_StratifiedKFoldIterate)->Apply(StratifiedArguments);
+BENCHMARK(BM_StratifiedKFoldMask)->Apply(StratifiedArguments);
+BENCHMARK(BM_StratifiedKFoldMaskFromIds)->Apply(StratifiedArguments);
+BENCHMARK(BM_ShuffleSplitSweep)->Apply(ShuffleArguments);
+BENCHMARK(BM_StratifiedShuffleSplitSweep)->Apply(ShuffleArguments);
+
+BENCHMARK_MAIN();
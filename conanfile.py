@@ -44,6 +44,8 @@ class FoldingConan(ConanFile):
         self.test_requires("catch2/3.8.1")
         self.test_requires("arff-files/1.2.1")
         self.test_requires("fimdlp/2.1.3")
+        # Benchmark dependencies
+        self.test_requires("benchmark/1.9.0")
 
     def layout(self):
         # Only use cmake_layout for conan packaging, not for development builds
@@ -7,130 +7,2708 @@
 #pragma once
 #include <torch/torch.h>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <queue>
 #include <random> 
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <folding_config.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 namespace folding {
-    class Fold {
+    // Non-owning view over a contiguous block of sample indices
+    template <typename Index>
+    class BasicIndexSpan {
     public:
-        inline Fold(int k, int n, int seed = -1) : k(k), n(n), seed(seed)
+        BasicIndexSpan() = default;
+        BasicIndexSpan(const Index* first, size_t count) : first(first), count(count) {}
+        inline const Index* begin() const { return first; }
+        inline const Index* end() const { return first + count; }
+        inline const Index* data() const { return first; }
+        inline size_t size() const { return count; }
+        inline bool empty() const { return count == 0; }
+        inline Index operator[](size_t i) const { return first[i]; }
+        inline Index front() const { return first[0]; }
+        inline Index back() const { return first[count - 1]; }
+    private:
+        const Index* first = nullptr;
+        size_t count = 0;
+    };
+    using IndexSpan = BasicIndexSpan<int>;
+    // Non-owning view over two contiguous blocks of sample indices traversed as a single sequence
+    template <typename Index>
+    class BasicIndexChain {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Index;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Index*;
+            using reference = const Index&;
+            iterator(const Index* current, const Index* head_end, const Index* tail_begin) : current(current), head_end(head_end), tail_begin(tail_begin) {}
+            inline reference operator*() const { return *current; }
+            inline iterator& operator++()
+            {
+                if (++current == head_end) current = tail_begin;
+                return *this;
+            }
+            inline iterator operator++(int) { auto it = *this; ++(*this); return it; }
+            inline bool operator==(const iterator& other) const { return current == other.current; }
+            inline bool operator!=(const iterator& other) const { return current != other.current; }
+        private:
+            const Index* current;
+            const Index* head_end;
+            const Index* tail_begin;
+        };
+        BasicIndexChain() = default;
+        BasicIndexChain(BasicIndexSpan<Index> head, BasicIndexSpan<Index> tail) : first(head), second(tail) {}
+        inline iterator begin() const { return iterator(first.empty() ? second.begin() : first.begin(), first.end(), second.begin()); }
+        inline iterator end() const { return iterator(second.end(), first.end(), second.begin()); }
+        inline size_t size() const { return first.size() + second.size(); }
+        inline bool empty() const { return size() == 0; }
+        inline Index operator[](size_t i) const { return i < first.size() ? first[i] : second[i - first.size()]; }
+        inline const BasicIndexSpan<Index>& head() const { return first; }
+        inline const BasicIndexSpan<Index>& tail() const { return second; }
+    private:
+        BasicIndexSpan<Index> first;
+        BasicIndexSpan<Index> second;
+    };
+    using IndexChain = BasicIndexChain<int>;
+    // Train and test samples of a fold. The views are valid as long as the Fold object that made them.
+    template <typename Index>
+    struct BasicFoldView {
+        BasicIndexChain<Index> train;
+        BasicIndexSpan<Index> test;
+    };
+    using FoldView = BasicFoldView<int>;
+    // SplitMix64 step, used to derive independent seeds from a master seed
+    inline uint64_t splitmix64(uint64_t& state)
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    // Random engine used to shuffle the samples. MT19937 reproduces the historical splits, which depend on
+    // the std::shuffle of each standard library. PHILOX uses a counter based generator and the shuffles
+    // of this library, giving the same folds on every platform.
+    enum class RandomEngine { MT19937, PHILOX };
+    // Philox4x32-10 counter based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3")
+    class Philox {
+    public:
+        using Block = std::array<uint32_t, 4>;
+        using Key = std::array<uint32_t, 2>;
+        static inline Block generate(Block counter, Key key)
+        {
+            for (int round = 0; round < 10; ++round) {
+                if (round > 0) {
+                    key[0] += 0x9E3779B9;
+                    key[1] += 0xBB67AE85;
+                }
+                uint64_t product0 = uint64_t(0xD2511F53) * counter[0];
+                uint64_t product1 = uint64_t(0xCD9E8D57) * counter[2];
+                counter = { uint32_t(product1 >> 32) ^ counter[1] ^ key[0], uint32_t(product1),
+                            uint32_t(product0 >> 32) ^ counter[3] ^ key[1], uint32_t(product0) };
+            }
+            return counter;
+        }
+    };
+    // Keyed pseudorandom permutation of [0, size) that can be evaluated, or inverted, at any point in O(1):
+    // a balanced Feistel network with Philox rounds on the smallest even number of bits covering size,
+    // cycling back into the domain when a value falls outside it.
+    class CounterPermutation {
+    public:
+        inline CounterPermutation(uint64_t size, uint32_t seed, uint32_t stream) : size(size), key({ seed, stream })
+        {
+            int bits = 2;
+            while (bits < 64 && (uint64_t(1) << bits) < size) {
+                bits += 2;
+            }
+            half_bits = bits / 2;
+            half_mask = (uint64_t(1) << half_bits) - 1;
+        }
+        inline uint64_t operator()(uint64_t position) const
+        {
+            do {
+                position = encrypt(position);
+            } while (position >= size);
+            return position;
+        }
+        inline uint64_t inverse(uint64_t value) const
+        {
+            do {
+                value = decrypt(value);
+            } while (value >= size);
+            return value;
+        }
+    private:
+        static constexpr int rounds = 6;
+        uint64_t size;
+        Philox::Key key;
+        int half_bits;
+        uint64_t half_mask;
+        inline uint64_t feistel(int round, uint64_t half) const
+        {
+            auto block = Philox::generate({ uint32_t(half), uint32_t(half >> 32), uint32_t(round), 0 }, key);
+            return ((uint64_t(block[1]) << 32) | block[0]) & half_mask;
+        }
+        inline uint64_t encrypt(uint64_t value) const
+        {
+            uint64_t left = value >> half_bits, right = value & half_mask;
+            for (int round = 0; round < rounds; ++round) {
+                auto next = left ^ feistel(round, right);
+                left = right;
+                right = next;
+            }
+            return (left << half_bits) | right;
+        }
+        inline uint64_t decrypt(uint64_t value) const
+        {
+            uint64_t left = value >> half_bits, right = value & half_mask;
+            for (int round = rounds - 1; round >= 0; --round) {
+                auto previous = right ^ feistel(round, left);
+                right = left;
+                left = previous;
+            }
+            return (left << half_bits) | right;
+        }
+    };
+    // Sample indices grouped by class in CSR layout: the samples of class labels[c] are
+    // indices[offsets[c], offsets[c + 1]) in ascending order. Classes are sorted by label.
+    template <typename Label, typename Index = int>
+    struct BasicClassGroups {
+        std::vector<Label> labels;
+        std::vector<Index> offsets;
+        std::vector<Index> indices;
+        inline int numberOfClasses() const { return labels.size(); }
+    };
+    using ClassGroups = BasicClassGroups<int>;
+    // Grouping through an ordered map, valid for any label values
+    template <typename Index = int, typename Label>
+    inline BasicClassGroups<Label, Index> groupByClassMap(const Label* y, int64_t n)
+    {
+        auto class_indices = std::map<Label, std::vector<Index>>();
+        for (Index i = 0; i < n; ++i) {
+            class_indices[y[i]].push_back(i);
+        }
+        auto groups = BasicClassGroups<Label, Index>();
+        groups.offsets.push_back(0);
+        groups.indices.reserve(n);
+        for (const auto& [label, samples] : class_indices) {
+            groups.labels.push_back(label);
+            groups.indices.insert(groups.indices.end(), samples.begin(), samples.end());
+            groups.offsets.push_back(groups.indices.size());
+        }
+        return groups;
+    }
+    // Counting sort grouping for labels in [0, num_classes): one histogram pass, a prefix sum and a scatter
+    template <typename Index = int, typename Label>
+    inline BasicClassGroups<Label, Index> groupByClassCounting(const Label* y, int64_t n, int64_t num_classes)
+    {
+        auto counts = std::vector<Index>(num_classes + 1, 0);
+        for (Index i = 0; i < n; ++i) {
+            counts[y[i] + 1]++;
+        }
+        auto groups = BasicClassGroups<Label, Index>();
+        groups.offsets.push_back(0);
+        for (int64_t label = 0; label < num_classes; ++label) {
+            if (counts[label + 1] > 0) { // Labels without samples are not classes
+                groups.labels.push_back(static_cast<Label>(label));
+                groups.offsets.push_back(groups.offsets.back() + counts[label + 1]);
+            }
+        }
+        std::partial_sum(counts.begin(), counts.end(), counts.begin());
+        groups.indices = std::vector<Index>(n);
+        for (Index i = 0; i < n; ++i) {
+            groups.indices[counts[y[i]]++] = i;
+        }
+        return groups;
+    }
+    // Use the counting sort when the labels are dense, i.e. in [0, n), and the map otherwise. The sample indices
+    // are of type Index, int unless given.
+    template <typename Index = int, typename Label>
+    inline BasicClassGroups<Label, Index> groupByClass(const Label* y, int64_t n)
+    {
+        if (n == 0) {
+            return groupByClassMap<Index>(y, n);
+        }
+        auto [min_label, max_label] = std::minmax_element(y, y + n);
+        if (static_cast<int64_t>(*min_label) >= 0 && static_cast<int64_t>(*max_label) < static_cast<int64_t>(n)) {
+            return groupByClassCounting<Index>(y, n, static_cast<int64_t>(*max_label) + 1);
+        }
+        return groupByClassMap<Index>(y, n);
+    }
+    // Shuffles with std::shuffle, whose results depend on the standard library
+    struct StdShuffler {
+        std::mt19937& rng;
+        template <typename Label, typename Iterator>
+        inline void operator()(Label, int, Iterator first, Iterator last) { std::shuffle(first, last, rng); }
+    };
+    // Shuffles with a CounterPermutation keyed by the seed, the label and the stream, so the order of the
+    // calls does not matter. Position p of the shuffled range takes the element at position permutation(p).
+    template <typename Index = int>
+    struct CounterShuffler {
+        uint32_t seed;
+        std::vector<Index> buffer;
+        // Labels beyond the int32 range also mix in their high bits
+        static inline uint32_t stream(int64_t label, int stream)
+        {
+            uint64_t state = (uint64_t(uint32_t(label)) << 1) | uint64_t(stream);
+            if (label != static_cast<int32_t>(label)) {
+                state ^= uint64_t(label) & 0xffffffff00000000ULL;
+            }
+            return static_cast<uint32_t>(splitmix64(state));
+        }
+        template <typename Label, typename Iterator>
+        inline void operator()(Label label, int stream_id, Iterator first, Iterator last)
+        {
+            buffer.assign(first, last);
+            auto permutation = CounterPermutation(buffer.size(), seed, stream(label, stream_id));
+            for (size_t position = 0; position < buffer.size(); ++position, ++first) {
+                *first = buffer[permutation(position)];
+            }
+        }
+    };
+    // Distributes the grouped samples among k folds keeping the class proportions. The samples of each class
+    // are shuffled in place in groups.indices. Writes the folds to indices (n values) in CSR layout with
+    // offsets (k + 1 values) and returns true if any class has fewer samples than folds. The folds that received
+    // the remainder samples of each class (size % k of them, in class order) are moved to remainders if given.
+    template <typename Label, typename Index, typename Shuffler>
+    inline bool stratify(BasicClassGroups<Label, Index>& groups, int k, Shuffler&& shuffler, Index* indices, Index* offsets, bool quiet = true, std::vector<int>* remainders = nullptr)
+    {
+        bool faulty = false;
+        // First pass: shuffle each class and decide how many of its samples go to each fold
+        auto fold_sizes = std::vector<Index>(k, 0);
+        auto remainder_folds = std::vector<int>(); // Folds receiving the remainder samples of each class, in class order
+        for (auto c = 0; c < groups.numberOfClasses(); ++c) {
+            auto samples_begin = groups.indices.begin() + groups.offsets[c];
+            auto samples_end = groups.indices.begin() + groups.offsets[c + 1];
+            shuffler(groups.labels[c], 0, samples_begin, samples_end);
+            int64_t num_samples = samples_end - samples_begin;
+            Index num_samples_to_take = num_samples / k;
+            int remainder_samples_to_take = num_samples % k;
+            if (num_samples_to_take == 0) {
+                if (!quiet)
+                    std::cerr << "Warning! The number of samples in class " << +groups.labels[c] << " (" << num_samples
+                    << ") is less than the number of folds (" << k << ")." << std::endl;
+                faulty = true;
+            }
+            for (auto& size : fold_sizes) {
+                size += num_samples_to_take;
+            }
+            if (remainder_samples_to_take > 0) {
+                auto chosen = std::vector<int>(k);
+                std::iota(chosen.begin(), chosen.end(), 0);
+                shuffler(groups.labels[c], 1, chosen.begin(), chosen.end());
+                chosen.resize(remainder_samples_to_take);
+                for (auto fold : chosen) {
+                    fold_sizes[fold]++;
+                    remainder_folds.push_back(fold);
+                }
+            }
+        }
+        offsets[0] = 0;
+        std::partial_sum(fold_sizes.begin(), fold_sizes.end(), offsets + 1);
+        // Second pass: scatter the samples of each class into the slices of their folds
+        auto cursor = std::vector<Index>(offsets, offsets + k);
+        auto next_remainder = remainder_folds.begin();
+        for (auto c = 0; c < groups.numberOfClasses(); ++c) {
+            auto it = groups.indices.begin() + groups.offsets[c];
+            auto samples_end = groups.indices.begin() + groups.offsets[c + 1];
+            Index num_samples_to_take = (samples_end - it) / k;
+            for (auto fold = 0; fold < k; ++fold) {
+                std::copy(it, it + num_samples_to_take, indices + cursor[fold]);
+                cursor[fold] += num_samples_to_take;
+                it += num_samples_to_take;
+            }
+            for (; it != samples_end; ++it) {
+                indices[cursor[*next_remainder++]++] = *it;
+            }
+        }
+        if (remainders != nullptr) {
+            *remainders = std::move(remainder_folds);
+        }
+        return faulty;
+    }
+    template <typename Label, typename Index>
+    inline bool stratify(BasicClassGroups<Label, Index>& groups, int k, std::mt19937& rng, Index* indices, Index* offsets, bool quiet = true, std::vector<int>* remainders = nullptr)
+    {
+        return stratify(groups, k, StdShuffler{ rng }, indices, offsets, quiet, remainders);
+    }
+    // Calls body(i) for i in [0, count) on up to max_threads threads (0 means one per hardware thread)
+    // and rethrows the first exception raised by any call
+    inline void parallelFor(int count, int max_threads, const std::function<void(int)>& body)
+    {
+        int hardware = std::max(1u, std::thread::hardware_concurrency());
+        int workers = std::max(1, std::min(count, max_threads <= 0 ? hardware : max_threads));
+        std::atomic<int> next{ 0 };
+        std::atomic<bool> failed{ false };
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto work = [&]() {
+            for (int i = next++; i < count && !failed; i = next++) {
+                try {
+                    body(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!failed.exchange(true)) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        };
+        auto threads = std::vector<std::thread>();
+        for (int worker = 1; worker < workers; ++worker) {
+            threads.emplace_back(work);
+        }
+        work();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    // Read only view of a whole file. It is memory mapped where available, so every process loading the
+    // same file shares one page cached copy of it.
+    class MappedFile {
+    public:
+        inline explicit MappedFile(const std::string& path)
+        {
+#ifndef _WIN32
+            int descriptor = ::open(path.c_str(), O_RDONLY);
+            if (descriptor == -1) {
+                throw std::runtime_error("Unable to open file " + path);
+            }
+            struct stat info;
+            if (::fstat(descriptor, &info) == -1) {
+                ::close(descriptor);
+                throw std::runtime_error("Unable to read the size of file " + path);
+            }
+            length = info.st_size;
+            if (length > 0) {
+                void* address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, descriptor, 0);
+                if (address == MAP_FAILED) {
+                    ::close(descriptor);
+                    throw std::runtime_error("Unable to map file " + path);
+                }
+                bytes = static_cast<const char*>(address);
+            }
+            ::close(descriptor);
+#else
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                throw std::runtime_error("Unable to open file " + path);
+            }
+            buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            bytes = buffer.data();
+            length = buffer.size();
+#endif
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        inline ~MappedFile()
+        {
+#ifndef _WIN32
+            if (bytes != nullptr) {
+                ::munmap(const_cast<char*>(bytes), length);
+            }
+#endif
+        }
+        inline const char* data() const { return bytes; }
+        inline size_t size() const { return length; }
+    private:
+        const char* bytes = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        std::vector<char> buffer;
+#endif
+    };
+    // Header of the binary fold files, followed by the offsets (k + 1 indices) and the permutation (n indices),
+    // stored as integers of index_size bytes, signed or not
+    struct FoldFileHeader {
+        static constexpr char signature[8] = { 'F', 'O', 'L', 'D', 'I', 'N', 'G', '\0' };
+        static constexpr uint32_t current_version = 1;
+        enum Kind : uint32_t { KFOLD = 1, STRATIFIED_KFOLD = 2, GROUP_KFOLD = 3, STRATIFIED_GROUP_KFOLD = 4, MULTILABEL_STRATIFIED_KFOLD = 5 };
+        char magic[8];
+        uint32_t version;
+        uint32_t kind;
+        uint64_t n;
+        uint32_t k;
+        int32_t seed;
+        uint32_t key; // Key the folds were built with, drawn at random when the seed is -1
+        uint32_t engine;
+        uint32_t faulty;
+        uint64_t label_hash;
+        uint32_t index_size;
+        uint32_t index_signed;
+    };
+    // FNV-1a hash of the labels, stored in the fold files to check they are loaded for the same labels.
+    // It depends on the label values only, not on their type: the high 32 bits are hashed only when
+    // the label is out of the int32 range.
+    // Passing the hash of some labels as hash continues it with the labels that follow them.
+    template <typename Label>
+    inline uint64_t hashLabels(const Label* y, size_t n, uint64_t hash = 0xcbf29ce484222325ULL)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            auto value = static_cast<int64_t>(y[i]);
+            auto label = static_cast<uint64_t>(value);
+            int bytes = value == static_cast<int32_t>(value) ? 4 : 8;
+            for (int byte = 0; byte < bytes; ++byte) {
+                hash = (hash ^ ((label >> (8 * byte)) & 0xff)) * 0x100000001b3ULL;
+            }
+        }
+        return hash;
+    }
+    // Calls visit with a pointer to the labels of an integer tensor, in its own type, so int32, int64,
+    // int16, int8 and uint8 labels are read without converting them. Only non contiguous tensors are copied.
+    template <typename Visitor>
+    inline void visitLabels(const torch::Tensor& y, Visitor&& visit, const std::string& name = "Labels")
+    {
+        auto labels = y.contiguous();
+        switch (labels.scalar_type()) {
+            case torch::kInt32: visit(labels.data_ptr<int32_t>()); break;
+            case torch::kInt64: visit(labels.data_ptr<int64_t>()); break;
+            case torch::kInt16: visit(labels.data_ptr<int16_t>()); break;
+            case torch::kInt8: visit(labels.data_ptr<int8_t>()); break;
+            case torch::kUInt8: visit(labels.data_ptr<uint8_t>()); break;
+            default: throw std::invalid_argument(name + " must be an integer tensor");
+        }
+    }
+    // Test mask of a fold from the fold of every sample (see Fold::getFoldIds), packed 64 samples per word as
+    // getFoldMask does. The comparisons of a word do not depend on each other, so the compiler can vectorize them.
+    template <typename FoldId>
+    inline void maskFromFoldIds(const FoldId* ids, size_t n, int fold, uint64_t* words)
+    {
+        auto target = static_cast<FoldId>(fold);
+        for (size_t word = 0; word < n / 64; ++word) {
+            uint64_t bits = 0;
+            for (int bit = 0; bit < 64; ++bit) {
+                bits |= uint64_t(ids[word * 64 + bit] == target) << bit;
+            }
+            words[word] = bits;
+        }
+        if (n % 64 != 0) {
+            uint64_t bits = 0;
+            for (size_t bit = 0; bit < n % 64; ++bit) {
+                bits |= uint64_t(ids[n / 64 * 64 + bit] == target) << bit;
+            }
+            words[n / 64] = bits;
+        }
+    }
+    // Samples of a fold gathered from a dataset. Passing the same object to getFoldData
+    // on every fold reuses its tensors as output buffers.
+    struct FoldData {
+        torch::Tensor X_train, X_test, y_train, y_test;
+        torch::Tensor train_indices, test_indices; // kInt64
+    };
+    // Contiguous range [start, stop) of samples
+    struct SampleRange {
+        int64_t start = 0;
+        int64_t stop = 0;
+        inline int64_t size() const { return stop - start; }
+    };
+    // Train and test samples of a fold, copied into buffers reused from fold to fold
+    template <typename Index>
+    struct BasicFoldSplit {
+        int fold = 0;
+        std::vector<Index> train;
+        std::vector<Index> test;
+    };
+    using FoldSplit = BasicFoldSplit<int>;
+    // Instrumentation of the splits, compiled in when FOLDING_INSTRUMENTATION is defined (ENABLE_INSTRUMENTATION in
+    // CMake). Without it the hooks are empty and the splits hold no statistics.
+#ifdef FOLDING_INSTRUMENTATION
+    inline constexpr bool instrumentation_enabled = true;
+#else
+    inline constexpr bool instrumentation_enabled = false;
+#endif
+    // What a split has cost and how balanced its folds are
+    struct FoldStats {
+        double build_seconds = 0; // Wall time of the construction
+        size_t build_bytes = 0; // Bytes of the index storage allocated by the construction
+        std::vector<int64_t> test_sizes; // Test size of every fold
+        double size_deviation = 0; // Largest |test size - mean test size| / mean test size
+        double class_deviation = 0; // Largest |share of a class in a test set - its share in all the samples|, when built from labels
+        uint64_t fold_calls = 0; // Copies of a fold by getFold and getFoldTensor (so getFoldData)
+        double fold_seconds = 0; // Their total wall time
+        size_t fold_bytes = 0; // Bytes they allocated for the indices
+    };
+    // One construction (fold -1) or one copy of a fold, with its own wall time and bytes allocated
+    struct FoldEvent {
+        enum Kind { BUILD, GET_FOLD } kind;
+        int fold;
+        double seconds;
+        size_t bytes;
+    };
+    // Receives every event with the statistics of its split so far. The calls for one split are serialized.
+    using StatsCallback = std::function<void(const FoldEvent& event, const FoldStats& stats)>;
+    inline StatsCallback& statsCallback()
+    {
+        static StatsCallback callback;
+        return callback;
+    }
+    // Not synchronized with the splits: set it before building them
+    inline void setStatsCallback(StatsCallback callback) { statsCallback() = std::move(callback); }
+    // Base of every split. Index is the integer type of the sample indices: the number of samples must fit
+    // in it, so narrow types (uint16_t, uint32_t) save memory on small datasets and int64_t goes beyond 2^31.
+    template <typename Index>
+    class BasicFold {
+    public:
+        using index_type = Index;
+        using FoldView = BasicFoldView<Index>;
+        using FoldSplit = BasicFoldSplit<Index>;
+        // Input iterator over the folds, owning the buffers each fold is copied into. The buffers are
+        // reserved for the largest fold when the iteration starts, so no fold allocates memory.
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = FoldSplit;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const FoldSplit*;
+            using reference = const FoldSplit&;
+            inline iterator(BasicFold* folds, int fold) : folds(folds)
+            {
+                split.fold = fold;
+                if (fold < folds->getNumberOfFolds()) {
+                    size_t max_train = 0, max_test = 0;
+                    for (int nFold = 0; nFold < folds->getNumberOfFolds(); ++nFold) {
+                        auto view = folds->getFoldView(nFold);
+                        max_train = std::max(max_train, view.train.size());
+                        max_test = std::max(max_test, view.test.size());
+                    }
+                    split.train.reserve(max_train);
+                    split.test.reserve(max_test);
+                    load();
+                }
+            }
+            inline reference operator*() const { return split; }
+            inline pointer operator->() const { return &split; }
+            inline iterator& operator++()
+            {
+                if (++split.fold < folds->getNumberOfFolds()) {
+                    load();
+                }
+                return *this;
+            }
+            inline bool operator==(const iterator& other) const { return split.fold == other.split.fold; }
+            inline bool operator!=(const iterator& other) const { return split.fold != other.split.fold; }
+        private:
+            BasicFold* folds;
+            FoldSplit split;
+            inline void load() { folds->getFold(split.fold, split.train, split.test); }
+        };
+        inline BasicFold(int k, int64_t n, int seed = -1, RandomEngine engine = RandomEngine::MT19937) : k(k), n(static_cast<Index>(n)), seed(seed), engine(engine)
         {
+            if (n < 0 || static_cast<uint64_t>(n) > static_cast<uint64_t>(std::numeric_limits<Index>::max())) {
+                throw std::invalid_argument("The number of samples (" + std::to_string(n) + ") does not fit in the index type");
+            }
             std::random_device rd;
-            random_seed = std::mt19937(seed == -1 ? rd() : seed);
+            counter_seed = seed == -1 ? rd() : seed;
+            random_seed = std::mt19937(counter_seed);
             std::srand(seed == -1 ? time(0) : seed);
         }
-        virtual std::pair<std::vector<int>, std::vector<int>> getFold(int nFold) = 0;
-        virtual ~Fold() = default;
+        virtual FoldView getFoldView(int nFold) = 0;
+        // Convenience wrapper over getFoldView that copies the indices
+        inline virtual std::pair<std::vector<Index>, std::vector<Index>> getFold(int nFold)
+        {
+            auto train = std::vector<Index>();
+            auto test = std::vector<Index>();
+            getFold(nFold, train, test);
+            return { std::move(train), std::move(test) };
+        }
+        // Same as above copying into the given vectors, which only allocate when their capacity is not enough
+        inline void getFold(int nFold, std::vector<Index>& train, std::vector<Index>& test)
+        {
+#ifdef FOLDING_INSTRUMENTATION
+            auto start = std::chrono::steady_clock::now();
+            auto train_capacity = train.capacity(), test_capacity = test.capacity();
+#endif
+            auto view = getFoldView(nFold);
+            train.clear();
+            train.reserve(view.train.size());
+            train.insert(train.end(), view.train.head().begin(), view.train.head().end());
+            train.insert(train.end(), view.train.tail().begin(), view.train.tail().end());
+            test.assign(view.test.begin(), view.test.end());
+#ifdef FOLDING_INSTRUMENTATION
+            size_t bytes = (train.capacity() > train_capacity ? train.capacity() : 0) + (test.capacity() > test_capacity ? test.capacity() : 0);
+            recordFold(nFold, start, bytes * sizeof(Index));
+#endif
+        }
+        // for (const auto& split : folds) visits every fold without allocating memory after the first one
+        inline iterator begin() { return iterator(this, 0); }
+        inline iterator end() { return iterator(this, getNumberOfFolds()); }
+        // Train and test indices of a fold as kInt64 tensors
+        inline std::pair<torch::Tensor, torch::Tensor> getFoldTensor(int nFold)
+        {
+            torch::Tensor train, test;
+            getFoldTensor(nFold, train, test);
+            return { train, test };
+        }
+        // Same as above writing into the given tensors, whose storage is reused when it is large enough
+        inline void getFoldTensor(int nFold, torch::Tensor& train, torch::Tensor& test)
+        {
+#ifdef FOLDING_INSTRUMENTATION
+            auto start = std::chrono::steady_clock::now();
+            auto train_storage = train.defined() ? train.data_ptr() : nullptr;
+            auto test_storage = test.defined() ? test.data_ptr() : nullptr;
+#endif
+            auto view = getFoldView(nFold);
+            auto train_data = prepareIndexTensor(train, view.train.size());
+            train_data = std::copy(view.train.head().begin(), view.train.head().end(), train_data);
+            std::copy(view.train.tail().begin(), view.train.tail().end(), train_data);
+            std::copy(view.test.begin(), view.test.end(), prepareIndexTensor(test, view.test.size()));
+#ifdef FOLDING_INSTRUMENTATION
+            size_t elements = (train.data_ptr() != train_storage ? train.numel() : 0) + (test.data_ptr() != test_storage ? test.numel() : 0);
+            recordFold(nFold, start, elements * sizeof(int64_t));
+#endif
+        }
+        // Gather the samples of a fold from X (features x samples, as in BayesNet, unless sample_dim says otherwise) and y
+        inline FoldData getFoldData(int nFold, const torch::Tensor& X, const torch::Tensor& y, int sample_dim = 1)
+        {
+            auto data = FoldData();
+            getFoldData(nFold, X, y, data, sample_dim);
+            return data;
+        }
+        // Same as above reusing the tensors of data as output buffers
+        inline virtual void getFoldData(int nFold, const torch::Tensor& X, const torch::Tensor& y, FoldData& data, int sample_dim = 1)
+        {
+            getFoldTensor(nFold, data.train_indices, data.test_indices);
+            gather(X, sample_dim, data.train_indices, data.X_train);
+            gather(X, sample_dim, data.test_indices, data.X_test);
+            gather(y, 0, data.train_indices, data.y_train);
+            gather(y, 0, data.test_indices, data.y_test);
+        }
+        // Test set of a fold as a bitset of one bit per sample: sample i is bit i % 64 of word i / 64. The train set is
+        // its negation, except for the bits past the last sample, which are always zero.
+        inline std::vector<uint64_t> getFoldMask(int nFold)
+        {
+            auto mask = std::vector<uint64_t>();
+            getFoldMask(nFold, mask);
+            return mask;
+        }
+        // Same as above writing into the given vector, which only allocates when its capacity is not enough
+        inline void getFoldMask(int nFold, std::vector<uint64_t>& mask)
+        {
+            auto view = getFoldView(nFold);
+            mask.assign((static_cast<size_t>(n) + 63) / 64, 0);
+            for (auto sample : view.test) {
+                mask[static_cast<size_t>(sample) / 64] |= uint64_t(1) << (static_cast<size_t>(sample) % 64);
+            }
+        }
+        // Test set of a fold as a kBool tensor of one element per sample, the train set being ~mask
+        inline torch::Tensor getFoldMaskTensor(int nFold)
+        {
+            torch::Tensor mask;
+            getFoldMaskTensor(nFold, mask);
+            return mask;
+        }
+        // Same as above writing into the given tensor, whose storage is reused when it is large enough
+        inline void getFoldMaskTensor(int nFold, torch::Tensor& mask)
+        {
+            auto view = getFoldView(nFold);
+            if (!mask.defined() || mask.scalar_type() != torch::kBool) {
+                mask = torch::empty({ static_cast<int64_t>(n) }, torch::kBool);
+            } else {
+                mask.resize_({ static_cast<int64_t>(n) });
+            }
+            auto data = mask.data_ptr<bool>();
+            std::fill(data, data + n, false);
+            for (auto sample : view.test) {
+                data[sample] = true;
+            }
+        }
+        // Fold whose test set holds each sample, as uint8_t (k < 255) or uint16_t (k < 65535), 4 or 2 times smaller than
+        // an int index per sample. Samples that are never tested get the largest FoldId value. The folds must
+        // be a partition of the samples, so a sample in the test set of two folds throws.
+        // maskFromFoldIds derives the mask of any fold from it.
+        template <typename FoldId = uint8_t>
+        inline std::vector<FoldId> getFoldIds()
+        {
+            constexpr auto untested = std::numeric_limits<FoldId>::max();
+            if (k >= static_cast<int>(untested)) {
+                throw std::invalid_argument("k (" + std::to_string(k) + ") does not fit in the fold id type");
+            }
+            auto ids = std::vector<FoldId>(n, untested);
+            for (int nFold = 0; nFold < k; ++nFold) {
+                for (auto sample : getFoldView(nFold).test) {
+                    if (ids[sample] != untested) {
+                        throw std::runtime_error("Sample " + std::to_string(sample) + " is in the test set of more than one fold");
+                    }
+                    ids[sample] = static_cast<FoldId>(nFold);
+                }
+            }
+            return ids;
+        }
+        virtual ~BasicFold() = default;
         std::string version() { return FOLDING_VERSION; }
         int getNumberOfFolds() { return k; }
+        RandomEngine getRandomEngine() const { return engine; }
+#ifdef FOLDING_INSTRUMENTATION
+        inline FoldStats getStats() const
+        {
+            std::lock_guard<std::mutex> lock(recorder.mutex);
+            return recorder.stats;
+        }
+#endif
     protected:
         int k;
-        int n;
+        Index n;
         int seed;
+        RandomEngine engine;
         std::mt19937 random_seed;
-    };
-    class KFold : public Fold {
-    public:
-        inline KFold(int k, int n, int seed = -1) : Fold(k, n, seed), indices(std::vector<int>(n))
+        uint32_t counter_seed; // Key of the counter based generator
+        // Called at the end of the constructors that build the folds, with the labels of the samples if any
+        template <typename Label = int>
+        inline void recordBuild(const Label* y = nullptr)
+        {
+#ifdef FOLDING_INSTRUMENTATION
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - recorder.start).count();
+            std::lock_guard<std::mutex> lock(recorder.mutex);
+            auto& stats = recorder.stats;
+            stats.build_seconds = seconds;
+            stats.build_bytes = allocatedBytes();
+            stats.test_sizes.assign(k, 0);
+            recorder.class_sizes.clear();
+            recorder.test_classes.assign(y != nullptr ? k : 0, {});
+            for (Index sample = 0; y != nullptr && sample < n; ++sample) {
+                recorder.class_sizes[static_cast<int64_t>(y[sample])]++;
+            }
+            auto composition = std::vector<Index>();
+            for (int nFold = 0; nFold < k; ++nFold) {
+                if (testComposition(nFold, composition)) {
+                    // One count per class, in ascending label order
+                    auto label = recorder.class_sizes.begin();
+                    for (auto count : composition) {
+                        stats.test_sizes[nFold] += count;
+                        if (y != nullptr) {
+                            recorder.test_classes[nFold][(label++)->first] = count;
+                        }
+                    }
+                    continue;
+                }
+                auto view = getFoldView(nFold);
+                stats.test_sizes[nFold] = view.test.size();
+                for (auto sample : view.test) {
+                    if (y != nullptr) {
+                        recorder.test_classes[nFold][static_cast<int64_t>(y[sample])]++;
+                    }
+                }
+            }
+            recorder.updateBalance(n);
+            if (statsCallback()) {
+                statsCallback()({ FoldEvent::BUILD, -1, seconds, stats.build_bytes }, stats);
+            }
+#else
+            (void)y;
+#endif
+        }
+#ifdef FOLDING_INSTRUMENTATION
+        // Statistics of the split, copied along with it
+        struct StatsRecorder {
+            FoldStats stats;
+            std::map<int64_t, int64_t> class_sizes; // Samples of every class, when built from labels
+            std::vector<std::map<int64_t, int64_t>> test_classes; // Test samples of every class in every fold, likewise
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            mutable std::mutex mutex;
+            StatsRecorder() = default;
+            StatsRecorder(const StatsRecorder& other) { *this = other; }
+            StatsRecorder& operator=(const StatsRecorder& other)
+            {
+                if (this != &other) {
+                    std::lock_guard<std::mutex> lock(other.mutex);
+                    stats = other.stats;
+                    class_sizes = other.class_sizes;
+                    test_classes = other.test_classes;
+                    start = other.start;
+                }
+                return *this;
+            }
+            // Deviations of the test sizes and of the class shares, with the mutex held
+            inline void updateBalance(int64_t n)
+            {
+                int64_t total = std::accumulate(stats.test_sizes.begin(), stats.test_sizes.end(), int64_t(0));
+                double mean = stats.test_sizes.empty() ? 0 : static_cast<double>(total) / stats.test_sizes.size();
+                stats.size_deviation = 0;
+                for (size_t nFold = 0; nFold < stats.test_sizes.size() && mean > 0; ++nFold) {
+                    stats.size_deviation = std::max(stats.size_deviation, std::abs(stats.test_sizes[nFold] - mean) / mean);
+                }
+                stats.class_deviation = 0;
+                for (size_t nFold = 0; nFold < test_classes.size(); ++nFold) {
+                    if (stats.test_sizes[nFold] == 0) {
+                        continue;
+                    }
+                    for (const auto& [label, size] : class_sizes) {
+                        auto count = test_classes[nFold].count(label) ? test_classes[nFold].at(label) : 0;
+                        auto share = static_cast<double>(count) / stats.test_sizes[nFold];
+                        stats.class_deviation = std::max(stats.class_deviation, std::abs(share - static_cast<double>(size) / n));
+                    }
+                }
+            }
+            inline FoldStats getStats() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return stats;
+            }
+        };
+        StatsRecorder recorder;
+        // Bytes of the index storage the split holds
+        inline virtual size_t allocatedBytes() const { return 0; }
+        // Test samples of every class of a fold (a single count without classes), for the splits that know them
+        // without building the fold. Returns false to have the fold built instead.
+        inline virtual bool testComposition(int, std::vector<Index>&) const { return false; }
+        // Refreshes the statistics after samples were added to the given folds
+        template <typename Label>
+        inline void recordAppend(const std::vector<int>& folds, const Label* y)
+        {
+            std::lock_guard<std::mutex> lock(recorder.mutex);
+            recorder.stats.build_bytes = allocatedBytes();
+            recorder.stats.test_sizes.resize(k, 0);
+            for (size_t i = 0; i < folds.size(); ++i) {
+                recorder.stats.test_sizes[folds[i]]++;
+                if (!recorder.test_classes.empty()) {
+                    recorder.class_sizes[static_cast<int64_t>(y[i])]++;
+                    recorder.test_classes[folds[i]][static_cast<int64_t>(y[i])]++;
+                }
+            }
+            recorder.updateBalance(n);
+        }
+        inline void recordFold(int nFold, std::chrono::steady_clock::time_point start, size_t bytes)
         {
-            std::iota(begin(indices), end(indices), 0); // fill with 0, 1, ..., n - 1
-            shuffle(indices.begin(), indices.end(), random_seed);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(recorder.mutex);
+            recorder.stats.fold_calls++;
+            recorder.stats.fold_seconds += seconds;
+            recorder.stats.fold_bytes += bytes;
+            if (statsCallback()) {
+                statsCallback()({ FoldEvent::GET_FOLD, nFold, seconds, bytes }, recorder.stats);
+            }
         }
-        inline std::pair<std::vector<int>, std::vector<int>> getFold(int nFold) override
+#endif
+        inline void checkFold(int nFold) const
         {
             if (nFold >= k || nFold < 0) {
                 throw std::out_of_range("nFold (" + std::to_string(nFold) + ") must be less than k (" + std::to_string(k) + ")");
             }
-            int nTest = n / k;
-            auto train = std::vector<int>();
-            auto test = std::vector<int>();
-            for (int i = 0; i < n; i++) {
-                if (i >= nTest * nFold && i < nTest * (nFold + 1)) {
-                    test.push_back(indices[i]);
-                } else {
-                    train.push_back(indices[i]);
-                }
+        }
+        static inline int64_t* prepareIndexTensor(torch::Tensor& tensor, size_t size)
+        {
+            if (!tensor.defined() || tensor.scalar_type() != torch::kInt64) {
+                tensor = torch::empty({ static_cast<int64_t>(size) }, torch::kInt64);
+            } else {
+                tensor.resize_({ static_cast<int64_t>(size) });
             }
-            return { train, test };
+            return tensor.data_ptr<int64_t>();
+        }
+        static inline void gather(const torch::Tensor& source, int dim, const torch::Tensor& index, torch::Tensor& output)
+        {
+            if (!output.defined() || output.scalar_type() != source.scalar_type()) {
+                output = torch::empty({ 0 }, source.options());
+            }
+            torch::index_select_out(output, source, dim, index);
+        }
+        // Test set is permutation[start, stop), train set is the rest of the permutation
+        inline FoldView makeView(const Index* permutation, size_t size, size_t start, size_t stop) const
+        {
+            using Span = BasicIndexSpan<Index>;
+            return { BasicIndexChain<Index>(Span(permutation, start), Span(permutation + stop, size - stop)), Span(permutation + start, stop - start) };
+        }
+    };
+    using Fold = BasicFold<int>;
+    // Folds stored as one permutation of the samples plus a k + 1 offsets table (CSR layout).
+    // The test samples of fold i are indices[offsets[i], offsets[i + 1]) and the train samples are the rest.
+    template <typename Index>
+    class BasicPermutationFold : public BasicFold<Index> {
+    public:
+        using typename BasicFold<Index>::FoldView;
+        inline BasicPermutationFold(int k, int64_t n, int seed = -1, RandomEngine engine = RandomEngine::MT19937) : BasicFold<Index>(k, n, seed, engine) {}
+        inline FoldView getFoldView(int nFold) override
+        {
+            this->checkFold(nFold);
+            auto fold_offsets = offsetsData();
+            return this->makeView(permutationData(), n, fold_offsets[nFold], fold_offsets[nFold + 1]);
+        }
+        inline BasicIndexSpan<Index> getPermutation() const { return BasicIndexSpan<Index>(permutationData(), n); }
+        inline BasicIndexSpan<Index> getOffsets() const { return BasicIndexSpan<Index>(offsetsData(), k + 1); }
+        // Writes the folds to a versioned binary file that load can map back into memory
+        inline void save(const std::string& path) const
+        {
+            auto header = FoldFileHeader();
+            std::copy(std::begin(FoldFileHeader::signature), std::end(FoldFileHeader::signature), header.magic);
+            header.version = FoldFileHeader::current_version;
+            header.kind = fileKind();
+            header.n = n;
+            header.k = k;
+            header.seed = seed;
+            header.key = this->counter_seed;
+            header.engine = static_cast<uint32_t>(engine);
+            header.faulty = isFaultyFile();
+            header.label_hash = labelHash();
+            header.index_size = sizeof(Index);
+            header.index_signed = std::is_signed_v<Index>;
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                throw std::runtime_error("Unable to create file " + path);
+            }
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(offsetsData()), sizeof(Index) * (k + 1));
+            file.write(reinterpret_cast<const char*>(permutationData()), sizeof(Index) * static_cast<size_t>(n));
+            if (!file) {
+                throw std::runtime_error("Unable to write file " + path);
+            }
+        }
+        virtual uint64_t labelHash() const { return 0; }
+    protected:
+        using BasicFold<Index>::k;
+        using BasicFold<Index>::n;
+        using BasicFold<Index>::seed;
+        using BasicFold<Index>::engine;
+        std::vector<Index> indices;
+        std::vector<Index> offsets;
+        // Set when the folds come from a file, in which case indices and offsets are empty
+        std::shared_ptr<MappedFile> mapping;
+#ifdef FOLDING_INSTRUMENTATION
+        inline size_t allocatedBytes() const override { return (indices.capacity() + offsets.capacity()) * sizeof(Index); }
+#endif
+        inline const Index* permutationData() const
+        {
+            return mapping ? reinterpret_cast<const Index*>(mapping->data() + sizeof(FoldFileHeader)) + k + 1 : indices.data();
+        }
+        inline const Index* offsetsData() const
+        {
+            return mapping ? reinterpret_cast<const Index*>(mapping->data() + sizeof(FoldFileHeader)) : offsets.data();
+        }
+        virtual uint32_t fileKind() const = 0;
+        virtual bool isFaultyFile() const { return false; }
+        // Takes the folds from a mapped file, along with the key they were built with
+        inline void attach(const FoldFileHeader& header, std::shared_ptr<MappedFile> file)
+        {
+            mapping = file;
+            this->counter_seed = header.key;
+            this->random_seed = std::mt19937(header.key);
+        }
+        // Maps a fold file and checks that it is well formed and of the expected kind
+        static inline std::pair<std::shared_ptr<MappedFile>, FoldFileHeader> open(const std::string& path, uint32_t kind)
+        {
+            auto mapping = std::make_shared<MappedFile>(path);
+            auto header = FoldFileHeader();
+            if (mapping->size() < sizeof(header)) {
+                throw std::invalid_argument("File " + path + " is not a fold file");
+            }
+            std::copy(mapping->data(), mapping->data() + sizeof(header), reinterpret_cast<char*>(&header));
+            if (!std::equal(std::begin(FoldFileHeader::signature), std::end(FoldFileHeader::signature), header.magic)) {
+                throw std::invalid_argument("File " + path + " is not a fold file");
+            }
+            if (header.version != FoldFileHeader::current_version) {
+                throw std::invalid_argument("Unsupported fold file version (" + std::to_string(header.version) + ") in " + path);
+            }
+            if (header.kind != kind) {
+                throw std::invalid_argument("File " + path + " holds a different kind of folds");
+            }
+            if (header.index_size != sizeof(Index) || header.index_signed != std::is_signed_v<Index>) {
+                throw std::invalid_argument("File " + path + " holds a different type of indices");
+            }
+            if (mapping->size() != sizeof(header) + sizeof(Index) * (header.k + 1 + header.n)) {
+                throw std::invalid_argument("File " + path + " is truncated");
+            }
+            // The views trust the offsets, so they must delimit slices of the permutation
+            auto offsets = reinterpret_cast<const Index*>(mapping->data() + sizeof(header));
+            bool valid = offsets[0] == 0 && static_cast<uint64_t>(offsets[header.k]) <= header.n;
+            for (uint32_t fold = 0; valid && fold < header.k; ++fold) {
+                valid = offsets[fold] <= offsets[fold + 1];
+            }
+            if (!valid) {
+                throw std::invalid_argument("File " + path + " holds invalid fold offsets");
+            }
+            return { mapping, header };
+        }
+    };
+    using PermutationFold = BasicPermutationFold<int>;
+    template <typename Index>
+    class BasicKFold : public BasicPermutationFold<Index> {
+    public:
+        inline BasicKFold(int k, int64_t n, int seed = -1, RandomEngine engine = RandomEngine::MT19937) : BasicPermutationFold<Index>(k, n, seed, engine)
+        {
+            indices = std::vector<Index>(this->n);
+            if (engine == RandomEngine::PHILOX) {
+                // Every position is computed independently, so the permutation is filled in parallel chunks
+                auto permutation = CounterPermutation(n, this->counter_seed, 0);
+                int chunks = (n + chunk_size - 1) / chunk_size;
+                parallelFor(chunks, 0, [&](int chunk) {
+                    int64_t last = std::min(n, static_cast<int64_t>(chunk + 1) * chunk_size);
+                    for (int64_t position = static_cast<int64_t>(chunk) * chunk_size; position < last; ++position) {
+                        indices[position] = static_cast<Index>(permutation(position));
+                    }
+                    });
+            } else {
+                std::iota(indices.begin(), indices.end(), Index(0)); // fill with 0, 1, ..., n - 1
+                shuffle(indices.begin(), indices.end(), this->random_seed);
+            }
+            // The last n % k samples of the permutation are always in the train set
+            Index nTest = this->n / k;
+            offsets = std::vector<Index>(k + 1);
+            for (int fold = 0; fold <= k; ++fold) {
+                offsets[fold] = nTest * fold;
+            }
+            this->recordBuild();
+        }
+        // Fold whose test set holds the sample, or -1 if the sample is always in the train set.
+        // O(1) without looking at the permutation with the PHILOX engine.
+        inline int foldOf(Index sample) const
+        {
+            if (static_cast<int64_t>(sample) < 0 || sample >= n) {
+                throw std::out_of_range("sample (" + std::to_string(sample) + ") must be in [0, " + std::to_string(n) + ")");
+            }
+            int64_t position;
+            if (engine == RandomEngine::PHILOX) {
+                position = CounterPermutation(n, this->counter_seed, 0).inverse(sample);
+            } else {
+                position = std::find(this->permutationData(), this->permutationData() + n, sample) - this->permutationData();
+            }
+            int64_t nTest = n / k;
+            return position < nTest * k ? position / nTest : -1;
+        }
+        // Folds saved with save, memory mapped instead of copied
+        static inline BasicKFold load(const std::string& path)
+        {
+            auto [mapping, header] = BasicPermutationFold<Index>::open(path, FoldFileHeader::KFOLD);
+            return BasicKFold(header, mapping);
         }
+    protected:
+        using BasicPermutationFold<Index>::k;
+        using BasicPermutationFold<Index>::n;
+        using BasicPermutationFold<Index>::engine;
+        using BasicPermutationFold<Index>::indices;
+        using BasicPermutationFold<Index>::offsets;
+        inline uint32_t fileKind() const override { return FoldFileHeader::KFOLD; }
     private:
-        std::vector<int> indices;
+        static constexpr int chunk_size = 1 << 16;
+        inline BasicKFold(const FoldFileHeader& header, std::shared_ptr<MappedFile> mapping)
+            : BasicPermutationFold<Index>(header.k, header.n, header.seed, static_cast<RandomEngine>(header.engine))
+        {
+            this->attach(header, mapping);
+        }
     };
-    class StratifiedKFold : public Fold {
+    using KFold = BasicKFold<int>;
+    // Label is the type of the labels given as a vector. Tensors of any integer type are read in their own type.
+    template <typename Index, typename Label = int>
+    class BasicStratifiedKFold : public BasicPermutationFold<Index> {
     public:
-        inline StratifiedKFold(int k, const std::vector<int>& y, int seed = -1, bool quiet = true) : Fold(k, y.size(), seed)
+        using label_type = Label;
+        inline BasicStratifiedKFold(int k, const std::vector<Label>& y, int seed = -1, bool quiet = true, RandomEngine engine = RandomEngine::MT19937) : BasicPermutationFold<Index>(k, y.size(), seed, engine)
         {
-            this->y = y;
-            n = y.size();
             this->quiet = quiet;
-            build();
+            label_hash = hashLabels(y.data(), y.size());
+            build(groupByClass<Index>(y.data(), n));
+            this->recordBuild(y.data());
         }
-        inline StratifiedKFold(int k, torch::Tensor& y, int seed = -1, bool quiet = true) : Fold(k, y.numel(), seed)
+        inline BasicStratifiedKFold(int k, torch::Tensor& y, int seed = -1, bool quiet = true, RandomEngine engine = RandomEngine::MT19937) : BasicPermutationFold<Index>(k, y.numel(), seed, engine)
         {
-            n = y.numel();
-            this->y = std::vector<int>(y.data_ptr<int>(), y.data_ptr<int>() + n);
             this->quiet = quiet;
-            build();
+            visitLabels(y, [this](const auto* labels) {
+                label_hash = hashLabels(labels, n);
+                build(groupByClass<Index>(labels, n));
+                this->recordBuild(labels);
+                });
         }
-
-        inline std::pair<std::vector<int>, std::vector<int>> getFold(int nFold) override
+        inline bool isFaulty() { return faulty; }
+        inline uint64_t labelHash() const override { return label_hash; }
+        // Adds the samples of a new batch of labels, numbered after the current ones, and returns the fold whose
+        // test set receives each of them. The folds of the existing samples do not change. Each class keeps
+        // filling its folds in the order the remainder logic of the build started: the folds that got one sample
+        // more than the others, followed by the rest in random order, and then a new random order for every k
+        // samples. So the sizes of a class in the folds never differ by more than one, as in a full build, and
+        // assigning a batch is O(batch + k). Making room for the new samples in the flat layout moves O(k batch)
+        // indices, as each fold only moves its first samples to its end, so the order of a test set may change.
+        inline std::vector<int> append(const std::vector<Label>& y)
         {
-            if (nFold >= k || nFold < 0) {
-                throw std::out_of_range("nFold (" + std::to_string(nFold) + ") must be less than k (" + std::to_string(k) + ")");
+            return appendLabels(y.data(), y.size());
+        }
+        inline std::vector<int> append(torch::Tensor& y)
+        {
+            auto folds = std::vector<int>();
+            visitLabels(y, [&](const auto* labels) { folds = appendLabels(labels, y.numel()); });
+            return folds;
+        }
+        // Folds saved with save, memory mapped instead of copied
+        static inline BasicStratifiedKFold load(const std::string& path)
+        {
+            auto [mapping, header] = BasicPermutationFold<Index>::open(path, FoldFileHeader::STRATIFIED_KFOLD);
+            return BasicStratifiedKFold(header, mapping);
+        }
+        // Same as above checking that the folds were built for the labels y
+        static inline BasicStratifiedKFold load(const std::string& path, const std::vector<Label>& y)
+        {
+            auto stratified_kfold = load(path);
+            if (stratified_kfold.labelHash() != hashLabels(y.data(), y.size()) || static_cast<size_t>(stratified_kfold.n) != y.size()) {
+                throw std::invalid_argument("The folds in " + path + " were built for different labels");
+            }
+            return stratified_kfold;
+        }
+        // Fold of the rank-th sample (in index order) of a class with class_size samples, with the PHILOX engine.
+        // O(1): it gives the same assignment as the StratifiedKFold built with the same seed without building it.
+        static inline int foldOf(int k, uint32_t seed, int64_t label, uint64_t class_size, uint64_t rank)
+        {
+            auto position = CounterPermutation(class_size, seed, CounterShuffler<>::stream(label, 0)).inverse(rank);
+            uint64_t num_samples_to_take = class_size / k;
+            if (position < num_samples_to_take * k) {
+                return position / num_samples_to_take;
             }
-            std::vector<int> test_indices = stratified_indices[nFold];
-            std::vector<int> train_indices;
-            for (int i = 0; i < k; ++i) {
-                if (i == nFold) continue;
-                train_indices.insert(train_indices.end(), stratified_indices[i].begin(), stratified_indices[i].end());
+            return CounterPermutation(k, seed, CounterShuffler<>::stream(label, 1))(position - num_samples_to_take * k);
+        }
+    protected:
+        using BasicPermutationFold<Index>::k;
+        using BasicPermutationFold<Index>::n;
+        using BasicPermutationFold<Index>::engine;
+        using BasicPermutationFold<Index>::indices;
+        using BasicPermutationFold<Index>::offsets;
+        inline uint32_t fileKind() const override { return FoldFileHeader::STRATIFIED_KFOLD; }
+        inline bool isFaultyFile() const override { return faulty; }
+        // Throws when the samples of the folds are fixed
+        inline virtual void checkAppend() const
+        {
+            if (this->mapping) {
+                throw std::runtime_error("Cannot append samples to folds loaded from a file");
             }
-            return { train_indices, test_indices };
         }
-        inline bool isFaulty() { return faulty; }
-    private:
-        std::vector<int> y;
-        std::vector<std::vector<int>> stratified_indices;
         bool faulty = false; // Only true if the number of samples of any class is less than the number of folds.
         bool quiet = true; // Enable or disable warning messages
-        void build()
-        {
-            stratified_indices = std::vector<std::vector<int>>(k);
-            // Compute class counts and indices
-            auto class_indices = std::map<int, std::vector<int>>();
-            for (auto i = 0; i < n; ++i) {
-                class_indices[y[i]].push_back(i);
-            }
-            // Assign indices to folds
-            for (auto& [label, indices] : class_indices) {
-                shuffle(indices.begin(), indices.end(), random_seed);
-                int num_samples = indices.size();
-                int num_samples_to_take = num_samples / k;
-                int remainder_samples_to_take = num_samples % k;
-                if (num_samples_to_take == 0) {
-                    if (!quiet)
-                        std::cerr << "Warning! The number of samples in class " << label << " (" << num_samples
-                        << ") is less than the number of folds (" << k << ")." << std::endl;
-                    faulty = true;
+        uint64_t label_hash = 0;
+        // For derived classes that group the labels themselves, which must call build
+        inline BasicStratifiedKFold(int k, int64_t n, int seed, bool quiet, RandomEngine engine) : BasicPermutationFold<Index>(k, n, seed, engine), quiet(quiet) {}
+        template <typename GroupLabel>
+        void build(BasicClassGroups<GroupLabel, Index> groups)
+        {
+            indices = std::vector<Index>(n);
+            offsets = std::vector<Index>(k + 1);
+            auto remainders = std::vector<int>();
+            if (engine == RandomEngine::PHILOX) {
+                faulty = stratify(groups, k, CounterShuffler<Index>{ this->counter_seed, {} }, indices.data(), offsets.data(), quiet, &remainders);
+            } else {
+                faulty = stratify(groups, k, this->random_seed, indices.data(), offsets.data(), quiet, &remainders);
+            }
+            // Where every class stands in the filling of its folds, for append
+            auto remainder = remainders.begin();
+            for (int c = 0; c < groups.numberOfClasses(); ++c) {
+                auto& state = classes[static_cast<int64_t>(groups.labels[c])];
+                state.count = groups.offsets[c + 1] - groups.offsets[c];
+                state.position = state.count % k;
+                state.order.assign(remainder, remainder + state.position);
+                remainder += state.position;
+            }
+        }
+    private:
+        // Progress of a class through its folds: order[position] is the fold of its next sample. Only the first
+        // position folds of the order are known, the rest is drawn when the next sample comes.
+        struct ClassFolds {
+            uint64_t count = 0;
+            uint64_t rounds = 0; // Orders drawn, which keys the PHILOX streams
+            int position = 0;
+            std::vector<int> order;
+        };
+        std::map<int64_t, ClassFolds> classes;
+        inline int nextFold(int64_t label, ClassFolds& state)
+        {
+            if (state.position == k) {
+                state.position = 0;
+                state.order.clear();
+            }
+            if (state.order.size() < static_cast<size_t>(k)) {
+                // Complete the order with the folds not in it yet, shuffled
+                auto pending = std::vector<char>(k, true);
+                for (auto fold : state.order) {
+                    pending[fold] = false;
                 }
-                int start = 0;
-                if (num_samples_to_take > 0) {
-                    for (auto fold = 0; fold < k; ++fold) {
-                        auto it = next(class_indices[label].begin() + start, num_samples_to_take);
-                        move(indices.begin() + start, it, back_inserter(stratified_indices[fold]));
-                        start += num_samples_to_take;
+                auto first = state.order.size();
+                for (int fold = 0; fold < k; ++fold) {
+                    if (pending[fold]) {
+                        state.order.push_back(fold);
                     }
                 }
-                if (remainder_samples_to_take > 0) {
-                    auto chosen = std::vector<int>(k);
-                    std::iota(chosen.begin(), chosen.end(), 0);
-                    std::shuffle(chosen.begin(), chosen.end(), random_seed);
-                    chosen.resize(remainder_samples_to_take);
-                    for (auto fold : chosen) {
-                        stratified_indices[fold].push_back(indices.at(start++));
+                if (engine == RandomEngine::PHILOX) {
+                    uint64_t key = (uint64_t(CounterShuffler<>::stream(label, 1)) << 32) | uint32_t(state.rounds);
+                    auto permutation = CounterPermutation(k - first, this->counter_seed, static_cast<uint32_t>(splitmix64(key)));
+                    auto drawn = std::vector<int>(state.order.begin() + first, state.order.end());
+                    for (size_t position = 0; position < drawn.size(); ++position) {
+                        state.order[first + position] = drawn[permutation(position)];
                     }
+                } else {
+                    std::shuffle(state.order.begin() + first, state.order.end(), this->random_seed);
                 }
+                state.rounds++;
+            }
+            state.count++;
+            return state.order[state.position++];
+        }
+        template <typename NewLabel>
+        std::vector<int> appendLabels(const NewLabel* y, size_t count)
+        {
+            checkAppend();
+            if (static_cast<uint64_t>(n) + count > static_cast<uint64_t>(std::numeric_limits<Index>::max())) {
+                throw std::invalid_argument("The number of samples (" + std::to_string(static_cast<uint64_t>(n) + count) + ") does not fit in the index type");
+            }
+            auto folds = std::vector<int>(count);
+            auto added = std::vector<Index>(k, 0);
+            for (size_t i = 0; i < count; ++i) {
+                auto label = static_cast<int64_t>(y[i]);
+                folds[i] = nextFold(label, classes[label]);
+                added[folds[i]]++;
+            }
+            // Shift the slices of the folds to their new offsets, from the last one. A slice shifted by less than its
+            // size only moves its first samples past its end. The new samples then go at the end of the slices.
+            Index old_n = n;
+            auto size = static_cast<size_t>(old_n) + count;
+            if (size > indices.capacity()) {
+                indices.reserve(std::max(size, 2 * indices.capacity()));
+            }
+            indices.resize(size);
+            auto shift = static_cast<Index>(count);
+            for (int fold = k - 1; fold >= 0; --fold) {
+                shift -= added[fold];
+                auto first = indices.begin() + offsets[fold];
+                auto moved = std::min(shift, static_cast<Index>(offsets[fold + 1] - offsets[fold]));
+                std::move(first, first + moved, indices.begin() + offsets[fold + 1] + shift - moved);
+                offsets[fold + 1] += shift + added[fold];
+            }
+            auto cursor = std::vector<Index>(k);
+            for (int fold = 0; fold < k; ++fold) {
+                cursor[fold] = offsets[fold + 1] - added[fold];
+            }
+            for (size_t i = 0; i < count; ++i) {
+                indices[cursor[folds[i]]++] = static_cast<Index>(old_n + i);
             }
+            n = static_cast<Index>(old_n + count);
+            label_hash = hashLabels(y, count, label_hash);
+            faulty = std::any_of(classes.begin(), classes.end(), [this](const auto& entry) { return entry.second.count < static_cast<uint64_t>(k); });
+#ifdef FOLDING_INSTRUMENTATION
+            this->recordAppend(folds, y);
+#endif
+            return folds;
+        }
+        inline BasicStratifiedKFold(const FoldFileHeader& header, std::shared_ptr<MappedFile> mapping)
+            : BasicPermutationFold<Index>(header.k, header.n, header.seed, static_cast<RandomEngine>(header.engine)), faulty(header.faulty != 0), label_hash(header.label_hash)
+        {
+            this->attach(header, mapping);
+        }
+    };
+    using StratifiedKFold = BasicStratifiedKFold<int, int>;
+    // Stratified k-fold of a subset of the samples given already grouped by class. The views hold the original
+    // sample indices, and the folds are the ones of a StratifiedKFold built with the same seed on the labels of
+    // the subset (in ascending index order), mapped back to the original indices.
+    template <typename Index>
+    class BasicSubsetStratifiedKFold : public BasicFold<Index> {
+    public:
+        using typename BasicFold<Index>::FoldView;
+        template <typename Label>
+        inline BasicSubsetStratifiedKFold(int k, BasicClassGroups<Label, Index> groups, int seed = -1, bool quiet = true, RandomEngine engine = RandomEngine::MT19937)
+            : BasicFold<Index>(k, groups.indices.size(), seed, engine)
+        {
+            indices = std::vector<Index>(this->n);
+            offsets = std::vector<Index>(k + 1);
+            if (engine == RandomEngine::PHILOX) {
+                faulty = stratify(groups, k, CounterShuffler<Index>{ this->counter_seed, {} }, indices.data(), offsets.data(), quiet);
+            } else {
+                faulty = stratify(groups, k, this->random_seed, indices.data(), offsets.data(), quiet);
+            }
+            this->recordBuild();
+        }
+        inline FoldView getFoldView(int nFold) override
+        {
+            this->checkFold(nFold);
+            return this->makeView(indices.data(), this->n, offsets[nFold], offsets[nFold + 1]);
+        }
+        inline bool isFaulty() const { return faulty; }
+    private:
+        std::vector<Index> indices;
+        std::vector<Index> offsets;
+        bool faulty = false;
+#ifdef FOLDING_INSTRUMENTATION
+        inline size_t allocatedBytes() const override { return (indices.capacity() + offsets.capacity()) * sizeof(Index); }
+#endif
+    };
+    // Nested stratified cross validation: the outer folds are a StratifiedKFold and the inner folds of outer fold o
+    // stratify its train samples, in global sample indices. The labels are grouped by class once; the inner
+    // grouping of each outer fold is filtered from it without reading the labels again. The inner folds are built
+    // on request and owned by the caller, so the outer folds can be evaluated in parallel.
+    template <typename Index, typename Label = int>
+    class BasicNestedStratifiedKFold : public BasicStratifiedKFold<Index, Label> {
+    public:
+        inline BasicNestedStratifiedKFold(int outer_k, int inner_k, const std::vector<Label>& y, int seed = -1, bool quiet = true, RandomEngine engine = RandomEngine::MT19937)
+            : BasicStratifiedKFold<Index, Label>(outer_k, y.size(), seed, quiet, engine), inner_k(inner_k)
+        {
+            this->label_hash = hashLabels(y.data(), y.size());
+            build(groupByClass<Index>(y.data(), this->n));
+            this->recordBuild(y.data());
+        }
+        inline BasicNestedStratifiedKFold(int outer_k, int inner_k, torch::Tensor& y, int seed = -1, bool quiet = true, RandomEngine engine = RandomEngine::MT19937)
+            : BasicStratifiedKFold<Index, Label>(outer_k, y.numel(), seed, quiet, engine), inner_k(inner_k)
+        {
+            visitLabels(y, [this](const auto* labels) {
+                this->label_hash = hashLabels(labels, this->n);
+                build(groupByClass<Index>(labels, this->n));
+                this->recordBuild(labels);
+                });
         }
+        inline int getNumberOfInnerFolds() const { return inner_k; }
+        // The inner groupings are filtered from the labels of the build, so the samples are fixed. append
+        // throws through a reference to StratifiedKFold too.
+        template <typename... Args>
+        std::vector<int> append(Args&&...) = delete;
+        // Seed of the inner folds of an outer fold, derived from the seed of the outer folds
+        inline int getInnerSeed(int outer_fold) const { return inner_seeds.at(outer_fold); }
+        // Inner folds of an outer fold, built on every call. Nothing is shared between the calls, so they can be
+        // made from several threads, e.g. from the workers of a CrossValidator over the outer folds.
+        inline BasicSubsetStratifiedKFold<Index> getInnerFolds(int outer_fold)
+        {
+            this->checkFold(outer_fold);
+            auto outer_test = this->getFoldView(outer_fold).test;
+            auto in_test = std::vector<char>(this->n, false);
+            for (auto sample : outer_test) {
+                in_test[sample] = true;
+            }
+            auto inner_groups = BasicClassGroups<int64_t, Index>();
+            inner_groups.offsets.push_back(0);
+            inner_groups.indices.reserve(this->n - outer_test.size());
+            for (int c = 0; c < groups.numberOfClasses(); ++c) {
+                for (auto sample = groups.indices.begin() + groups.offsets[c]; sample != groups.indices.begin() + groups.offsets[c + 1]; ++sample) {
+                    if (!in_test[*sample]) {
+                        inner_groups.indices.push_back(*sample);
+                    }
+                }
+                if (inner_groups.indices.size() > static_cast<size_t>(inner_groups.offsets.back())) {
+                    inner_groups.labels.push_back(groups.labels[c]);
+                    inner_groups.offsets.push_back(inner_groups.indices.size());
+                }
+            }
+            return BasicSubsetStratifiedKFold<Index>(inner_k, std::move(inner_groups), inner_seeds[outer_fold], this->quiet, this->engine);
+        }
+    private:
+        int inner_k;
+        std::vector<int> inner_seeds;
+        BasicClassGroups<int64_t, Index> groups; // Samples of each class in ascending order
+        inline void checkAppend() const override { throw std::runtime_error("Cannot append samples to nested folds"); }
+        template <typename GroupLabel>
+        void build(BasicClassGroups<GroupLabel, Index> class_groups)
+        {
+            groups.labels.assign(class_groups.labels.begin(), class_groups.labels.end());
+            groups.offsets = class_groups.offsets;
+            groups.indices = class_groups.indices;
+            BasicStratifiedKFold<Index, Label>::build(std::move(class_groups));
+            auto state = static_cast<uint64_t>(this->counter_seed);
+            for (int fold = 0; fold < this->k; ++fold) {
+                inner_seeds.push_back(static_cast<int>(splitmix64(state) >> 33));
+            }
+        }
+    };
+    using NestedStratifiedKFold = BasicNestedStratifiedKFold<int, int>;
+    // Rows grouped by group in CSR layout: the rows of group g are rows[offsets[g], offsets[g + 1]) in ascending
+    // order. Groups are numbered in order of first appearance through a hash table, so any group values work.
+    template <typename Index>
+    struct GroupIndex {
+        std::vector<Index> ids; // Group of every row
+        std::vector<Index> offsets;
+        std::vector<Index> rows;
+        inline size_t numberOfGroups() const { return offsets.size() - 1; }
+        inline Index size(size_t group) const { return offsets[group + 1] - offsets[group]; }
+    };
+    template <typename Group, typename Index>
+    inline GroupIndex<Index> indexGroups(const Group* groups, Index n)
+    {
+        auto index = GroupIndex<Index>();
+        auto numbers = std::unordered_map<Group, Index>();
+        auto counts = std::vector<Index>(1, 0);
+        index.ids = std::vector<Index>(n);
+        for (Index row = 0; row < n; ++row) {
+            auto [it, inserted] = numbers.try_emplace(groups[row], static_cast<Index>(numbers.size()));
+            if (inserted) {
+                counts.push_back(0);
+            }
+            index.ids[row] = it->second;
+            counts[it->second + 1]++;
+        }
+        std::partial_sum(counts.begin(), counts.end(), counts.begin());
+        index.offsets = counts;
+        index.rows = std::vector<Index>(n);
+        for (Index row = 0; row < n; ++row) {
+            index.rows[counts[index.ids[row]]++] = row;
+        }
+        return index;
+    }
+    // Folds made of whole groups: the rows of a group are always in the same fold, so no group is ever
+    // split between the train and the test sets
+    template <typename Index>
+    class BasicGroupFold : public BasicPermutationFold<Index> {
+    public:
+        inline BasicGroupFold(int k, int64_t n, int seed = -1) : BasicPermutationFold<Index>(k, n, seed) {}
+    protected:
+        using BasicPermutationFold<Index>::k;
+        using BasicPermutationFold<Index>::n;
+        using BasicPermutationFold<Index>::indices;
+        using BasicPermutationFold<Index>::offsets;
+        inline void checkGroups(size_t number_of_groups) const
+        {
+            if (number_of_groups < static_cast<size_t>(k)) {
+                throw std::invalid_argument("Cannot have number of folds (" + std::to_string(k) + ") greater than the number of groups (" + std::to_string(number_of_groups) + ")");
+            }
+        }
+        // Writes the rows of every fold in ascending order given the fold of every group
+        inline void scatter(const GroupIndex<Index>& index, const std::vector<int>& group_folds)
+        {
+            offsets = std::vector<Index>(k + 1, 0);
+            for (size_t group = 0; group < group_folds.size(); ++group) {
+                offsets[group_folds[group] + 1] += index.size(group);
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            indices = std::vector<Index>(n);
+            auto cursor = std::vector<Index>(offsets.begin(), offsets.end() - 1);
+            for (Index row = 0; row < n; ++row) {
+                indices[cursor[group_folds[index.ids[row]]]++] = row;
+            }
+        }
+    };
+    // K-fold over groups. The groups are taken from the largest to the smallest and each one goes to the fold
+    // with the fewest rows so far, kept in a min-heap, which is O(n + G log G) for G groups.
+    // As in scikit-learn the split is deterministic.
+    template <typename Index, typename Group = int>
+    class BasicGroupKFold : public BasicGroupFold<Index> {
+    public:
+        inline BasicGroupKFold(int k, const std::vector<Group>& groups) : BasicGroupFold<Index>(k, groups.size())
+        {
+            build(indexGroups(groups.data(), this->n));
+            this->recordBuild();
+        }
+        inline BasicGroupKFold(int k, torch::Tensor& groups) : BasicGroupFold<Index>(k, groups.numel())
+        {
+            visitLabels(groups, [this](const auto* values) { build(indexGroups(values, this->n)); }, "Groups");
+            this->recordBuild();
+        }
+        // Folds saved with save, memory mapped instead of copied
+        static inline BasicGroupKFold load(const std::string& path)
+        {
+            auto [mapping, header] = BasicPermutationFold<Index>::open(path, FoldFileHeader::GROUP_KFOLD);
+            return BasicGroupKFold(header, mapping);
+        }
+    protected:
+        inline uint32_t fileKind() const override { return FoldFileHeader::GROUP_KFOLD; }
+    private:
+        inline BasicGroupKFold(const FoldFileHeader& header, std::shared_ptr<MappedFile> mapping) : BasicGroupFold<Index>(header.k, header.n, header.seed)
+        {
+            this->attach(header, mapping);
+        }
+        void build(const GroupIndex<Index>& index)
+        {
+            auto number_of_groups = index.numberOfGroups();
+            this->checkGroups(number_of_groups);
+            auto order = std::vector<size_t>(number_of_groups);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&index](size_t a, size_t b) { return index.size(a) > index.size(b); });
+            using FoldRows = std::pair<int64_t, int>; // Rows in the fold, fold
+            auto folds = std::priority_queue<FoldRows, std::vector<FoldRows>, std::greater<FoldRows>>();
+            for (int fold = 0; fold < this->k; ++fold) {
+                folds.push({ 0, fold });
+            }
+            auto group_folds = std::vector<int>(number_of_groups);
+            for (auto group : order) {
+                auto [rows, fold] = folds.top();
+                folds.pop();
+                group_folds[group] = fold;
+                folds.push({ rows + index.size(group), fold });
+            }
+            this->scatter(index, group_folds);
+        }
+    };
+    using GroupKFold = BasicGroupKFold<int, int>;
+    // Stratified k-fold over groups, with the greedy assignment of scikit-learn's StratifiedGroupKFold. The groups
+    // are taken in decreasing order of the standard deviation of their class counts and each one goes to the fold
+    // that keeps the class distribution most even: the lowest sum over the classes of the standard deviation,
+    // across folds, of the share of the class in each fold. Ties go to the fold with the fewest rows.
+    // The standard deviations are kept as per class running sums, so scoring a fold only looks at the classes
+    // present in the group: O(k * n + G log G) overall.
+    template <typename Index, typename Label = int, typename Group = int>
+    class BasicStratifiedGroupKFold : public BasicGroupFold<Index> {
+    public:
+        // shuffle randomizes the order of the groups whose class counts have the same standard deviation
+        inline BasicStratifiedGroupKFold(int k, const std::vector<Label>& y, const std::vector<Group>& groups, bool shuffle = false, int seed = -1)
+            : BasicGroupFold<Index>(k, y.size(), seed)
+        {
+            checkSizes(y.size(), groups.size());
+            build(y.data(), indexGroups(groups.data(), this->n), shuffle);
+            this->recordBuild(y.data());
+        }
+        inline BasicStratifiedGroupKFold(int k, torch::Tensor& y, torch::Tensor& groups, bool shuffle = false, int seed = -1)
+            : BasicGroupFold<Index>(k, y.numel(), seed)
+        {
+            checkSizes(y.numel(), groups.numel());
+            visitLabels(y, [&](const auto* labels) {
+                visitLabels(groups, [&](const auto* values) { build(labels, indexGroups(values, this->n), shuffle); }, "Groups");
+                this->recordBuild(labels);
+                });
+        }
+        // Folds saved with save, memory mapped instead of copied
+        static inline BasicStratifiedGroupKFold load(const std::string& path)
+        {
+            auto [mapping, header] = BasicPermutationFold<Index>::open(path, FoldFileHeader::STRATIFIED_GROUP_KFOLD);
+            return BasicStratifiedGroupKFold(header, mapping);
+        }
+    protected:
+        inline uint32_t fileKind() const override { return FoldFileHeader::STRATIFIED_GROUP_KFOLD; }
+    private:
+        inline BasicStratifiedGroupKFold(const FoldFileHeader& header, std::shared_ptr<MappedFile> mapping) : BasicGroupFold<Index>(header.k, header.n, header.seed)
+        {
+            this->attach(header, mapping);
+        }
+        static inline void checkSizes(size_t labels, size_t groups)
+        {
+            if (labels != groups) {
+                throw std::invalid_argument("The number of labels (" + std::to_string(labels) + ") and groups (" + std::to_string(groups) + ") must be equal");
+            }
+        }
+        static inline double deviation(double sum, double sum_of_squares, int count)
+        {
+            double mean = sum / count;
+            double variance = sum_of_squares / count - mean * mean;
+            return variance > 0 ? std::sqrt(variance) : 0;
+        }
+        template <typename YLabel>
+        void build(const YLabel* y, const GroupIndex<Index>& index, bool shuffle)
+        {
+            int k = this->k;
+            Index n = this->n;
+            auto number_of_groups = index.numberOfGroups();
+            this->checkGroups(number_of_groups);
+            // Dense class numbers through a hash table
+            auto class_numbers = std::unordered_map<YLabel, int>();
+            auto classes = std::vector<int>(n);
+            for (Index row = 0; row < n; ++row) {
+                classes[row] = class_numbers.try_emplace(y[row], static_cast<int>(class_numbers.size())).first->second;
+            }
+            int number_of_classes = class_numbers.size();
+            auto class_sizes = std::vector<double>(number_of_classes, 0);
+            for (auto label : classes) {
+                class_sizes[label]++;
+            }
+            // Class counts of every group as sparse (class, count) lists in CSR layout
+            auto group_offsets = std::vector<size_t>(1, 0);
+            auto group_classes = std::vector<int>();
+            auto group_counts = std::vector<Index>();
+            auto counts = std::vector<Index>(number_of_classes, 0);
+            auto group_deviations = std::vector<double>(number_of_groups);
+            group_offsets.reserve(number_of_groups + 1);
+            for (size_t group = 0; group < number_of_groups; ++group) {
+                auto first = group_classes.size();
+                for (auto row = index.offsets[group]; row < index.offsets[group + 1]; ++row) {
+                    if (counts[classes[index.rows[row]]]++ == 0) {
+                        group_classes.push_back(classes[index.rows[row]]);
+                    }
+                }
+                double sum = 0, sum_of_squares = 0;
+                for (auto entry = first; entry < group_classes.size(); ++entry) {
+                    double count = counts[group_classes[entry]];
+                    group_counts.push_back(counts[group_classes[entry]]);
+                    counts[group_classes[entry]] = 0;
+                    sum += count;
+                    sum_of_squares += count * count;
+                }
+                group_offsets.push_back(group_classes.size());
+                group_deviations[group] = deviation(sum, sum_of_squares, number_of_classes);
+            }
+            auto order = std::vector<size_t>(number_of_groups);
+            std::iota(order.begin(), order.end(), 0);
+            if (shuffle) {
+                std::shuffle(order.begin(), order.end(), this->random_seed);
+            }
+            std::stable_sort(order.begin(), order.end(), [&group_deviations](size_t a, size_t b) { return group_deviations[a] > group_deviations[b]; });
+            // Share of every class in every fold, plus the sum and the sum of squares of the shares of each class
+            auto shares = std::vector<double>(static_cast<size_t>(k) * number_of_classes, 0);
+            auto share_sums = std::vector<double>(number_of_classes, 0);
+            auto share_squares = std::vector<double>(number_of_classes, 0);
+            auto fold_rows = std::vector<int64_t>(k, 0);
+            auto group_folds = std::vector<int>(number_of_groups);
+            constexpr double tolerance = 1e-9;
+            for (auto group : order) {
+                int best_fold = 0;
+                double best_score = 0;
+                for (int fold = 0; fold < k; ++fold) {
+                    // Change of the score if the group goes to this fold, only the classes of the group change
+                    double score = 0;
+                    for (auto entry = group_offsets[group]; entry < group_offsets[group + 1]; ++entry) {
+                        int label = group_classes[entry];
+                        double delta = group_counts[entry] / class_sizes[label];
+                        double share = shares[static_cast<size_t>(fold) * number_of_classes + label];
+                        score += deviation(share_sums[label] + delta, share_squares[label] + (2 * share + delta) * delta, k)
+                            - deviation(share_sums[label], share_squares[label], k);
+                    }
+                    if (fold == 0 || score < best_score - tolerance || (score <= best_score + tolerance && fold_rows[fold] < fold_rows[best_fold])) {
+                        best_fold = fold;
+                        best_score = score;
+                    }
+                }
+                for (auto entry = group_offsets[group]; entry < group_offsets[group + 1]; ++entry) {
+                    int label = group_classes[entry];
+                    double delta = group_counts[entry] / class_sizes[label];
+                    double& share = shares[static_cast<size_t>(best_fold) * number_of_classes + label];
+                    share_sums[label] += delta;
+                    share_squares[label] += (2 * share + delta) * delta;
+                    share += delta;
+                }
+                fold_rows[best_fold] += index.size(group);
+                group_folds[group] = best_fold;
+            }
+            this->scatter(index, group_folds);
+        }
+    };
+    using StratifiedGroupKFold = BasicStratifiedGroupKFold<int, int, int>;
+    // Stratified k-fold for multi-label targets, with the iterative stratification of Sechidis, Tsoumakas and
+    // Vlahavas (2011). The label with the fewest samples left is taken from a min-heap and its samples go, one
+    // by one, to the fold that needs that label the most, then the fold that needs samples the most, then one
+    // at random. The heap is updated lazily, with one entry per (sample, label) pair assigned, so the build is
+    // O(nnz log nnz + n k) for nnz pairs instead of rescanning the labels after every sample. Samples without
+    // labels go last to the folds that need samples the most.
+    template <typename Index>
+    class BasicMultilabelStratifiedKFold : public BasicPermutationFold<Index> {
+    public:
+        // The labels of sample i are labels[row_offsets[i], row_offsets[i + 1]) (CSR layout)
+        inline BasicMultilabelStratifiedKFold(int k, const std::vector<int64_t>& row_offsets, const std::vector<int64_t>& labels, int seed = -1)
+            : BasicPermutationFold<Index>(k, row_offsets.empty() ? 0 : row_offsets.size() - 1, seed)
+        {
+            int64_t number_of_labels = labels.empty() ? 0 : *std::max_element(labels.begin(), labels.end()) + 1;
+            build(row_offsets.data(), labels.data(), labels.size(), number_of_labels);
+            this->recordBuild();
+        }
+        // Label matrix of samples x labels, dense of any integer, bool or floating type (any non zero value is a
+        // label of the sample) or sparse CSR (every stored entry is a label of the sample)
+        inline BasicMultilabelStratifiedKFold(int k, torch::Tensor& y, int seed = -1)
+            : BasicPermutationFold<Index>(k, y.dim() == 2 ? y.size(0) : 0, seed)
+        {
+            if (y.dim() != 2) {
+                throw std::invalid_argument("The label matrix must have 2 dimensions, not " + std::to_string(y.dim()));
+            }
+            if (y.layout() == torch::kSparseCsr) {
+                auto labels = y.col_indices();
+                visitLabels(y.crow_indices(), [&](const auto* row_offsets) {
+                    visitLabels(labels, [&](const auto* label_indices) { build(row_offsets, label_indices, labels.numel(), y.size(1)); }, "Label indices");
+                    }, "Row offsets");
+            } else {
+                auto row_offsets = std::vector<int64_t>(1, 0);
+                auto labels = std::vector<int64_t>();
+                int64_t number_of_labels = y.size(1);
+                auto dense = y.is_floating_point() ? y.ne(0).to(torch::kUInt8) : y.scalar_type() == torch::kBool ? y.to(torch::kUInt8) : y;
+                visitLabels(dense, [&](const auto* values) {
+                    for (Index row = 0; row < this->n; ++row) {
+                        for (int64_t label = 0; label < number_of_labels; ++label) {
+                            if (values[row * number_of_labels + label] != 0) {
+                                labels.push_back(label);
+                            }
+                        }
+                        row_offsets.push_back(labels.size());
+                    }
+                    });
+                build(row_offsets.data(), labels.data(), labels.size(), number_of_labels);
+            }
+            this->recordBuild();
+        }
+        // Folds saved with save, memory mapped instead of copied
+        static inline BasicMultilabelStratifiedKFold load(const std::string& path)
+        {
+            auto [mapping, header] = BasicPermutationFold<Index>::open(path, FoldFileHeader::MULTILABEL_STRATIFIED_KFOLD);
+            return BasicMultilabelStratifiedKFold(header, mapping);
+        }
+    protected:
+        inline uint32_t fileKind() const override { return FoldFileHeader::MULTILABEL_STRATIFIED_KFOLD; }
+    private:
+        inline BasicMultilabelStratifiedKFold(const FoldFileHeader& header, std::shared_ptr<MappedFile> mapping) : BasicPermutationFold<Index>(header.k, header.n, header.seed)
+        {
+            this->attach(header, mapping);
+        }
+        // Fold among the candidates with the highest need, ties broken at random
+        template <typename Need>
+        inline int neediest(const std::vector<int>& candidates, Need&& need)
+        {
+            int best = candidates.front(), ties = 1;
+            for (size_t i = 1; i < candidates.size(); ++i) {
+                double difference = need(candidates[i]) - need(best);
+                if (difference > 0) {
+                    best = candidates[i];
+                    ties = 1;
+                } else if (difference == 0 && this->random_seed() % ++ties == 0) {
+                    best = candidates[i];
+                }
+            }
+            return best;
+        }
+        template <typename Offset, typename LabelIndex>
+        void build(const Offset* row_offsets, const LabelIndex* labels, size_t nnz, int64_t number_of_labels)
+        {
+            int k = this->k;
+            Index n = this->n;
+            if (k > n) {
+                throw std::invalid_argument("Cannot have number of folds (" + std::to_string(k) + ") greater than the number of samples (" + std::to_string(n) + ")");
+            }
+            if (row_offsets[0] != 0 || static_cast<size_t>(row_offsets[n]) != nnz) {
+                throw std::invalid_argument("The row offsets must go from 0 to the number of labels (" + std::to_string(nnz) + ")");
+            }
+            // Samples of every label in CSC layout, each list in the same random order of the samples
+            auto order = std::vector<Index>(n);
+            std::iota(order.begin(), order.end(), Index(0));
+            std::shuffle(order.begin(), order.end(), this->random_seed);
+            auto label_offsets = std::vector<size_t>(number_of_labels + 1, 0);
+            for (Index row = 0; row < n; ++row) {
+                if (row_offsets[row] > row_offsets[row + 1]) {
+                    throw std::invalid_argument("The row offsets must be non decreasing");
+                }
+                for (auto entry = row_offsets[row]; entry < row_offsets[row + 1]; ++entry) {
+                    if (labels[entry] < 0 || labels[entry] >= number_of_labels) {
+                        throw std::invalid_argument("Label index (" + std::to_string(labels[entry]) + ") must be in [0, " + std::to_string(number_of_labels) + ")");
+                    }
+                    label_offsets[labels[entry] + 1]++;
+                }
+            }
+            std::partial_sum(label_offsets.begin(), label_offsets.end(), label_offsets.begin());
+            auto label_rows = std::vector<Index>(nnz);
+            auto cursor = std::vector<size_t>(label_offsets.begin(), label_offsets.end() - 1);
+            for (auto row : order) {
+                for (auto entry = row_offsets[row]; entry < row_offsets[row + 1]; ++entry) {
+                    label_rows[cursor[labels[entry]]++] = row;
+                }
+            }
+            // Samples each fold still needs, of every label and in total
+            auto label_needs = std::vector<double>(static_cast<size_t>(k) * number_of_labels);
+            auto remaining = std::vector<int64_t>(number_of_labels);
+            using Entry = std::pair<int64_t, int64_t>; // Samples left, label
+            auto heap = std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>();
+            for (int64_t label = 0; label < number_of_labels; ++label) {
+                remaining[label] = label_offsets[label + 1] - label_offsets[label];
+                for (int fold = 0; fold < k; ++fold) {
+                    label_needs[static_cast<size_t>(fold) * number_of_labels + label] = static_cast<double>(remaining[label]) / k;
+                }
+                if (remaining[label] > 0) {
+                    heap.emplace(remaining[label], label);
+                }
+            }
+            auto needs = std::vector<double>(k, static_cast<double>(n) / k);
+            auto row_folds = std::vector<int>(n, -1);
+            auto folds = std::vector<int>(k);
+            std::iota(folds.begin(), folds.end(), 0);
+            auto candidates = std::vector<int>();
+            while (!heap.empty()) {
+                auto [left, label] = heap.top();
+                heap.pop();
+                if (left != remaining[label]) {
+                    continue; // Outdated entry
+                }
+                for (auto entry = label_offsets[label]; entry < label_offsets[label + 1]; ++entry) {
+                    auto row = label_rows[entry];
+                    if (row_folds[row] != -1) {
+                        continue;
+                    }
+                    // The folds that need this label the most, then the one that needs samples the most
+                    double most = -std::numeric_limits<double>::infinity();
+                    candidates.clear();
+                    for (int fold = 0; fold < k; ++fold) {
+                        double need = label_needs[static_cast<size_t>(fold) * number_of_labels + label];
+                        if (need > most) {
+                            most = need;
+                            candidates.clear();
+                        }
+                        if (need == most) {
+                            candidates.push_back(fold);
+                        }
+                    }
+                    int fold = neediest(candidates, [&needs](int candidate) { return needs[candidate]; });
+                    row_folds[row] = fold;
+                    needs[fold]--;
+                    for (auto other = row_offsets[row]; other < row_offsets[row + 1]; ++other) {
+                        label_needs[static_cast<size_t>(fold) * number_of_labels + labels[other]]--;
+                        if (--remaining[labels[other]] > 0 && labels[other] != label) {
+                            heap.emplace(remaining[labels[other]], labels[other]);
+                        }
+                    }
+                }
+            }
+            for (auto row : order) {
+                if (row_folds[row] == -1) {
+                    int fold = neediest(folds, [&needs](int candidate) { return needs[candidate]; });
+                    row_folds[row] = fold;
+                    needs[fold]--;
+                }
+            }
+            // Rows of every fold in ascending order
+            this->offsets = std::vector<Index>(k + 1, 0);
+            for (auto fold : row_folds) {
+                this->offsets[fold + 1]++;
+            }
+            std::partial_sum(this->offsets.begin(), this->offsets.end(), this->offsets.begin());
+            this->indices = std::vector<Index>(n);
+            auto fold_cursor = std::vector<Index>(this->offsets.begin(), this->offsets.end() - 1);
+            for (Index row = 0; row < n; ++row) {
+                this->indices[fold_cursor[row_folds[row]]++] = row;
+            }
+        }
+    };
+    using MultilabelStratifiedKFold = BasicMultilabelStratifiedKFold<int>;
+    // Runs the callback when the calling thread ends
+    inline void atThreadExit(std::function<void()> callback)
+    {
+        struct Callbacks {
+            std::vector<std::function<void()>> list;
+            ~Callbacks()
+            {
+                for (auto& callback : list) {
+                    callback();
+                }
+            }
+        };
+        thread_local Callbacks callbacks;
+        callbacks.list.push_back(std::move(callback));
+    }
+    // Random train/test splits (Monte Carlo cross validation). Each thread keeps its own arrangement of the samples,
+    // and split s moves its test samples to the tail of it with a partial Fisher-Yates shuffle driven by a Philox
+    // stream of its own. The swaps are logged and undone before the next split, so a split costs O(test size)
+    // instead of O(n) and any split can be generated on its own, in any order and in parallel.
+    // The view of a split is valid until the same thread asks for another split of the same object. The arrangement
+    // of a thread goes back to a pool when the thread ends, and the next thread takes it from there, so the split
+    // holds one arrangement per thread running at the same time (e.g. the workers of a CrossValidator), not one
+    // per thread that ever used it, and only the first threads pay the O(n) copy.
+    template <typename Index>
+    class BasicRandomSplitFold : public BasicFold<Index> {
+    public:
+        using typename BasicFold<Index>::FoldView;
+        // The arrangements belong to one split
+        BasicRandomSplitFold(const BasicRandomSplitFold&) = delete;
+        BasicRandomSplitFold& operator=(const BasicRandomSplitFold&) = delete;
+        inline BasicRandomSplitFold(int n_splits, int64_t n, double test_size, int seed) : BasicFold<Index>(n_splits, n, seed, RandomEngine::PHILOX)
+        {
+            if (n_splits < 1) {
+                throw std::invalid_argument("n_splits (" + std::to_string(n_splits) + ") must be greater than 0");
+            }
+            if (!(test_size > 0 && test_size < 1)) {
+                throw std::invalid_argument("test_size (" + std::to_string(test_size) + ") must be in (0, 1)");
+            }
+            test_samples = static_cast<Index>(std::ceil(test_size * n));
+            if (test_samples < 1 || test_samples >= this->n) {
+                throw std::invalid_argument("test_size (" + std::to_string(test_size) + ") leaves no train or no test samples out of " + std::to_string(n));
+            }
+        }
+        inline FoldView getFoldView(int nFold) override
+        {
+            this->checkFold(nFold);
+            auto& workspace = threadWorkspace();
+            undo(workspace);
+            shuffle(nFold, workspace);
+            return this->makeView(workspace.arrangement.data(), this->n, this->n - test_samples, this->n);
+        }
+        inline Index getTestSize() const { return test_samples; }
+        inline Index getTrainSize() const { return this->n - test_samples; }
+    protected:
+        Index test_samples = 0;
+        // Arrangement of the samples before any split, made of slices (the classes for the stratified splits)
+        // whose test samples are drawn separately: slice c is arrangement[slices[c], slices[c + 1])
+        std::vector<Index> arrangement;
+        std::vector<Index> slices;
+#ifdef FOLDING_INSTRUMENTATION
+        inline size_t allocatedBytes() const override { return (arrangement.capacity() + slices.capacity()) * sizeof(Index); }
+        // Every split has test_samples test samples, spread among the slices by testCounts: no need to shuffle
+        inline bool testComposition(int split, std::vector<Index>& counts) const override
+        {
+            testCounts(split, counts);
+            return true;
+        }
+#endif
+        // Number of test samples of every slice in a split
+        virtual void testCounts(int split, std::vector<Index>& counts) const = 0;
+        // Random 64 bits number of a split, from its own Philox stream
+        inline uint64_t random(int split, uint32_t stream, uint64_t counter) const
+        {
+            auto block = Philox::generate({ uint32_t(counter), uint32_t(counter >> 32), stream, 0 }, { this->counter_seed, uint32_t(split) });
+            return (uint64_t(block[1]) << 32) | block[0];
+        }
+    private:
+        struct Workspace {
+            std::vector<Index> arrangement;
+            std::vector<std::pair<Index, Index>> swaps; // Swaps made by the current split, in order
+            std::vector<Index> counts;
+        };
+        struct WorkspacePool {
+            std::mutex mutex;
+            std::unordered_map<std::thread::id, std::unique_ptr<Workspace>> in_use;
+            std::vector<std::unique_ptr<Workspace>> free; // Left by the threads that ended, with their swaps undone
+        };
+        std::shared_ptr<WorkspacePool> workspaces = std::make_shared<WorkspacePool>();
+        inline Workspace& threadWorkspace()
+        {
+            std::lock_guard<std::mutex> lock(workspaces->mutex);
+            auto id = std::this_thread::get_id();
+            auto& workspace = workspaces->in_use[id];
+            if (!workspace) {
+                if (!workspaces->free.empty()) {
+                    workspace = std::move(workspaces->free.back());
+                    workspaces->free.pop_back();
+                } else {
+                    workspace = std::make_unique<Workspace>();
+                    workspace->arrangement = arrangement;
+                    workspace->swaps.reserve(2 * static_cast<size_t>(test_samples));
+                }
+                atThreadExit([pool = std::weak_ptr<WorkspacePool>(workspaces), id]() {
+                    if (auto workspaces = pool.lock()) {
+                        std::lock_guard<std::mutex> lock(workspaces->mutex);
+                        auto entry = workspaces->in_use.find(id);
+                        undo(*entry->second);
+                        workspaces->free.push_back(std::move(entry->second));
+                        workspaces->in_use.erase(entry);
+                    }
+                    });
+            }
+            return *workspace;
+        }
+        static inline void swap(Workspace& workspace, Index a, Index b)
+        {
+            if (a != b) {
+                std::swap(workspace.arrangement[a], workspace.arrangement[b]);
+                workspace.swaps.emplace_back(a, b);
+            }
+        }
+        static inline void undo(Workspace& workspace)
+        {
+            for (auto swap = workspace.swaps.rbegin(); swap != workspace.swaps.rend(); ++swap) {
+                std::swap(workspace.arrangement[swap->first], workspace.arrangement[swap->second]);
+            }
+            workspace.swaps.clear();
+        }
+        // From the last slice to the first: draw its test samples to the tail of the slice, then move them up
+        // by the train samples of the later slices so that they join the test samples already placed
+        inline void shuffle(int split, Workspace& workspace) const
+        {
+            testCounts(split, workspace.counts);
+            uint64_t counter = 0;
+            Index placed = 0;
+            for (auto slice = static_cast<int>(slices.size()) - 2; slice >= 0; --slice) {
+                Index first = slices[slice], last = slices[slice + 1], take = workspace.counts[slice];
+                for (Index i = 0; i < take; ++i) {
+                    Index position = last - 1 - i;
+                    uint64_t choices = static_cast<uint64_t>(position - first) + 1;
+                    swap(workspace, position, first + static_cast<Index>(random(split, 0, counter++) % choices));
+                }
+                Index shift = this->n - placed - last;
+                for (Index i = 0; i < take; ++i) {
+                    Index position = last - 1 - i;
+                    swap(workspace, position, position + shift);
+                }
+                placed += take;
+            }
+        }
+    };
+    // Random splits with ceil(test_size * n) test samples, the rest being the train samples
+    template <typename Index>
+    class BasicShuffleSplit : public BasicRandomSplitFold<Index> {
+    public:
+        inline BasicShuffleSplit(int n_splits, int64_t n, double test_size = 0.1, int seed = -1) : BasicRandomSplitFold<Index>(n_splits, n, test_size, seed)
+        {
+            this->arrangement = std::vector<Index>(this->n);
+            std::iota(this->arrangement.begin(), this->arrangement.end(), Index(0));
+            this->slices = { 0, this->n };
+            this->recordBuild();
+        }
+    protected:
+        inline void testCounts(int, std::vector<Index>& counts) const override { counts.assign(1, this->test_samples); }
+    };
+    using ShuffleSplit = BasicShuffleSplit<int>;
+    // Random splits keeping the class proportions in the test set. The labels are grouped by class once and
+    // the test samples of every split are spread among the classes by largest remainder, with the ties
+    // broken at random for each split.
+    template <typename Index, typename Label = int>
+    class BasicStratifiedShuffleSplit : public BasicRandomSplitFold<Index> {
+    public:
+        inline BasicStratifiedShuffleSplit(int n_splits, const std::vector<Label>& y, double test_size = 0.1, int seed = -1)
+            : BasicRandomSplitFold<Index>(n_splits, y.size(), test_size, seed)
+        {
+            build(groupByClass<Index>(y.data(), this->n));
+            this->recordBuild(y.data());
+        }
+        inline BasicStratifiedShuffleSplit(int n_splits, torch::Tensor& y, double test_size = 0.1, int seed = -1)
+            : BasicRandomSplitFold<Index>(n_splits, y.numel(), test_size, seed)
+        {
+            visitLabels(y, [this](const auto* labels) {
+                build(groupByClass<Index>(labels, this->n));
+                this->recordBuild(labels);
+                });
+        }
+    protected:
+        inline void testCounts(int split, std::vector<Index>& counts) const override
+        {
+            int classes = this->slices.size() - 1;
+            counts.resize(classes);
+            auto remainders = std::vector<std::tuple<uint64_t, uint64_t, int>>(); // Remainder, random tie breaker, class
+            remainders.reserve(classes);
+            Index assigned = 0;
+            for (int label = 0; label < classes; ++label) {
+                uint64_t scaled = static_cast<uint64_t>(this->test_samples) * (this->slices[label + 1] - this->slices[label]);
+                counts[label] = static_cast<Index>(scaled / this->n);
+                assigned += counts[label];
+                remainders.emplace_back(scaled % this->n, this->random(split, 1, label), label);
+            }
+            std::sort(remainders.begin(), remainders.end(), std::greater<>());
+            for (Index i = 0; i < this->test_samples - assigned; ++i) {
+                counts[std::get<2>(remainders[i])]++;
+            }
+        }
+    private:
+        template <typename GroupLabel>
+        void build(const BasicClassGroups<GroupLabel, Index>& groups)
+        {
+            auto classes = static_cast<Index>(groups.numberOfClasses());
+            for (int label = 0; label < groups.numberOfClasses(); ++label) {
+                if (groups.offsets[label + 1] - groups.offsets[label] < 2) {
+                    throw std::invalid_argument("The least populated class in y has only 1 member, which is too few. The minimum number of members in any class cannot be less than 2");
+                }
+            }
+            if (this->test_samples < classes || this->n - this->test_samples < classes) {
+                throw std::invalid_argument("The train and test sizes (" + std::to_string(this->n - this->test_samples) + ", " + std::to_string(this->test_samples)
+                    + ") must be greater or equal than the number of classes (" + std::to_string(classes) + ")");
+            }
+            this->arrangement = groups.indices;
+            this->slices = groups.offsets;
+        }
+    };
+    using StratifiedShuffleSplit = BasicStratifiedShuffleSplit<int, int>;
+    // Splits of ordered samples, as scikit-learn's TimeSeriesSplit: the test set of split i is the i-th of the last
+    // n_splits blocks of test_size samples (n / (n_splits + 1) by default) and the train set is every sample before
+    // it, leaving out the gap samples just before the test set. The train set is an expanding window, or a sliding
+    // one of at most max_train_size samples. Every split is a pair of ranges, O(1) memory: getFoldData narrows the
+    // feature and label tensors instead of copying them, and the views only materialize an array of the n sample indices, shared
+    // by all the splits, the first time one is asked for.
+    template <typename Index>
+    class BasicTimeSeriesSplit : public BasicFold<Index> {
+    public:
+        using typename BasicFold<Index>::FoldView;
+        using BasicFold<Index>::getFoldData;
+        inline BasicTimeSeriesSplit(int n_splits, int64_t n, int64_t max_train_size = 0, int64_t test_size = 0, int64_t gap = 0)
+            : BasicFold<Index>(n_splits, n), max_train_size(max_train_size), test_size(test_size), gap(gap)
+        {
+            if (n_splits < 1) {
+                throw std::invalid_argument("n_splits (" + std::to_string(n_splits) + ") must be greater than 0");
+            }
+            if (max_train_size < 0 || test_size < 0 || gap < 0) {
+                throw std::invalid_argument("max_train_size, test_size and gap must be greater or equal than 0");
+            }
+            if (n_splits + 1 > n) {
+                throw std::invalid_argument("Cannot have number of folds (" + std::to_string(n_splits + 1) + ") greater than the number of samples (" + std::to_string(n) + ")");
+            }
+            if (this->test_size == 0) {
+                this->test_size = n / (n_splits + 1);
+            }
+            if (n - gap - this->test_size * n_splits <= 0) {
+                throw std::invalid_argument("Too many splits (" + std::to_string(n_splits) + ") for the number of samples (" + std::to_string(n)
+                    + ") with test_size (" + std::to_string(this->test_size) + ") and gap (" + std::to_string(gap) + ")");
+            }
+            this->recordBuild();
+        }
+        // Train and test ranges of a split
+        inline std::pair<SampleRange, SampleRange> getFoldRanges(int nFold) const
+        {
+            this->checkFold(nFold);
+            int64_t test_start = static_cast<int64_t>(this->n) - (this->k - nFold) * test_size;
+            int64_t train_stop = test_start - gap;
+            int64_t train_start = max_train_size > 0 ? std::max<int64_t>(0, train_stop - max_train_size) : 0;
+            return { { train_start, train_stop }, { test_start, test_start + test_size } };
+        }
+        inline FoldView getFoldView(int nFold) override
+        {
+            auto [train, test] = getFoldRanges(nFold);
+            std::call_once(identity_flag, [this]() {
+                identity = std::vector<Index>(this->n);
+                std::iota(identity.begin(), identity.end(), Index(0));
+                });
+            using Span = BasicIndexSpan<Index>;
+            return { BasicIndexChain<Index>(Span(identity.data() + train.start, train.size()), Span()), Span(identity.data() + test.start, test.size()) };
+        }
+        // X_train, X_test, y_train and y_test are narrowed views of X and y sharing their storage, not copies.
+        // train_indices and test_indices are filled as for any other split, reusing their storage when it is large
+        // enough; getFoldRanges gives the same samples without allocating.
+        inline void getFoldData(int nFold, const torch::Tensor& X, const torch::Tensor& y, FoldData& data, int sample_dim = 1) override
+        {
+            auto [train, test] = getFoldRanges(nFold);
+            data.X_train = X.narrow(sample_dim, train.start, train.size());
+            data.X_test = X.narrow(sample_dim, test.start, test.size());
+            data.y_train = y.narrow(0, train.start, train.size());
+            data.y_test = y.narrow(0, test.start, test.size());
+            auto train_data = this->prepareIndexTensor(data.train_indices, static_cast<size_t>(train.size()));
+            std::iota(train_data, train_data + train.size(), train.start);
+            auto test_data = this->prepareIndexTensor(data.test_indices, static_cast<size_t>(test.size()));
+            std::iota(test_data, test_data + test.size(), test.start);
+        }
+        inline int64_t getTestSize() const { return test_size; }
+        inline int64_t getGap() const { return gap; }
+        inline int64_t getMaxTrainSize() const { return max_train_size; }
+    private:
+        int64_t max_train_size;
+        int64_t test_size;
+        int64_t gap;
+        std::once_flag identity_flag;
+        std::vector<Index> identity;
+    };
+    using TimeSeriesSplit = BasicTimeSeriesSplit<int>;
+    // R repetitions of a k-fold split, each one with its own seed derived from the master seed.
+    // Split i is fold i % k of repetition i / k, so getNumberOfFolds() returns R * k.
+    // The repetitions are built in parallel and do not depend on the number of threads used.
+    class RepeatedFold : public Fold {
+    public:
+        inline RepeatedFold(int k, int n, int repeats, int seed = -1) : Fold(k * repeats, n, seed), folds_per_repeat(k), repeats(repeats)
+        {
+            if (repeats < 1) {
+                throw std::invalid_argument("repeats (" + std::to_string(repeats) + ") must be greater than 0");
+            }
+            auto state = static_cast<uint64_t>(seed == -1 ? std::random_device()() : seed);
+            for (int repeat = 0; repeat < repeats; ++repeat) {
+                repeat_seeds.push_back(static_cast<int>(splitmix64(state) >> 33));
+            }
+            indices = std::vector<int>(static_cast<size_t>(repeats) * n);
+            offsets = std::vector<int>(static_cast<size_t>(repeats) * (k + 1));
+        }
+        inline FoldView getFoldView(int nFold) override
+        {
+            checkFold(nFold);
+            int repeat = nFold / folds_per_repeat;
+            int fold = nFold % folds_per_repeat;
+            const int* repeat_offsets = offsets.data() + static_cast<size_t>(repeat) * (folds_per_repeat + 1);
+            return makeView(indices.data() + static_cast<size_t>(repeat) * n, n, repeat_offsets[fold], repeat_offsets[fold + 1]);
+        }
+        inline int getNumberOfRepeats() const { return repeats; }
+        inline int getFoldsPerRepeat() const { return folds_per_repeat; }
+        // Seed of a repetition, which gives the same split as a single KFold / StratifiedKFold built with it
+        inline int getRepeatSeed(int repeat) const { return repeat_seeds.at(repeat); }
+    protected:
+        int folds_per_repeat;
+        int repeats;
+        std::vector<int> repeat_seeds;
+        std::vector<int> indices; // Permutation of repetition r is indices[r * n, (r + 1) * n)
+        std::vector<int> offsets; // Offsets of repetition r are offsets[r * (k + 1), (r + 1) * (k + 1))
+        inline int* repeatIndices(int repeat) { return indices.data() + static_cast<size_t>(repeat) * n; }
+        inline int* repeatOffsets(int repeat) { return offsets.data() + static_cast<size_t>(repeat) * (folds_per_repeat + 1); }
+#ifdef FOLDING_INSTRUMENTATION
+        inline size_t allocatedBytes() const override { return (indices.capacity() + offsets.capacity()) * sizeof(int); }
+#endif
+    };
+    class RepeatedKFold : public RepeatedFold {
+    public:
+        inline RepeatedKFold(int k, int n, int repeats, int seed = -1, int max_threads = 0) : RepeatedFold(k, n, repeats, seed)
+        {
+            parallelFor(repeats, max_threads, [this](int repeat) {
+                auto permutation = repeatIndices(repeat);
+                auto rng = std::mt19937(repeat_seeds[repeat]);
+                std::iota(permutation, permutation + this->n, 0);
+                std::shuffle(permutation, permutation + this->n, rng);
+                int nTest = this->n / folds_per_repeat;
+                for (int fold = 0; fold <= folds_per_repeat; ++fold) {
+                    repeatOffsets(repeat)[fold] = nTest * fold;
+                }
+                });
+            recordBuild();
+        }
+    };
+    class RepeatedStratifiedKFold : public RepeatedFold {
+    public:
+        inline RepeatedStratifiedKFold(int k, const std::vector<int>& y, int repeats, int seed = -1, bool quiet = true, int max_threads = 0) : RepeatedFold(k, y.size(), repeats, seed)
+        {
+            build(groupByClass(y.data(), n), quiet, max_threads);
+            recordBuild(y.data());
+        }
+        inline RepeatedStratifiedKFold(int k, torch::Tensor& y, int repeats, int seed = -1, bool quiet = true, int max_threads = 0) : RepeatedFold(k, y.numel(), repeats, seed)
+        {
+            visitLabels(y, [&](const auto* labels) {
+                build(groupByClass(labels, n), quiet, max_threads);
+                recordBuild(labels);
+                });
+        }
+        inline bool isFaulty() { return faulty; }
+    private:
+        bool faulty = false;
+        // The labels are grouped once and every repetition shuffles its own copy of the groups
+        template <typename Label>
+        void build(const BasicClassGroups<Label>& groups, bool quiet, int max_threads)
+        {
+            auto faulty_repeats = std::vector<char>(repeats, false);
+            parallelFor(repeats, max_threads, [&](int repeat) {
+                auto repeat_groups = groups;
+                auto rng = std::mt19937(repeat_seeds[repeat]);
+                // The warnings are the same for every repetition, so only the first one reports them
+                faulty_repeats[repeat] = stratify(repeat_groups, folds_per_repeat, rng, repeatIndices(repeat), repeatOffsets(repeat), quiet || repeat > 0);
+                });
+            faulty = faulty_repeats[0];
+        }
+    };
+    // Labels read in chunks, which can be rewound to read them again
+    class LabelSource {
+    public:
+        virtual ~LabelSource() = default;
+        // Copies up to capacity labels into buffer and returns how many were copied, 0 at the end
+        virtual size_t read(int* buffer, size_t capacity) = 0;
+        virtual void rewind() = 0;
+    };
+    class VectorLabelSource : public LabelSource {
+    public:
+        inline explicit VectorLabelSource(const std::vector<int>& y) : y(y) {}
+        inline size_t read(int* buffer, size_t capacity) override
+        {
+            size_t count = std::min(capacity, y.size() - position);
+            std::copy(y.begin() + position, y.begin() + position + count, buffer);
+            position += count;
+            return count;
+        }
+        inline void rewind() override { position = 0; }
+    private:
+        const std::vector<int>& y;
+        size_t position = 0;
+    };
+    // Labels stored in a file as raw int32 values, memory mapped so they are paged in and out as they are read
+    class MappedLabelSource : public LabelSource {
+    public:
+        inline explicit MappedLabelSource(const std::string& path) : file(path)
+        {
+            if (file.size() % sizeof(int) != 0) {
+                throw std::invalid_argument("File " + path + " does not hold int32 labels");
+            }
+        }
+        inline size_t read(int* buffer, size_t capacity) override
+        {
+            size_t count = std::min(capacity, file.size() / sizeof(int) - position);
+            std::copy_n(reinterpret_cast<const int*>(file.data()) + position, count, buffer);
+            position += count;
+            return count;
+        }
+        inline void rewind() override { position = 0; }
+    private:
+        MappedFile file;
+        size_t position = 0;
+    };
+    // Stratified k-fold for label sets that do not fit in memory. The labels are streamed from a LabelSource
+    // and only the class counts are kept, O(C) state. Samples are assigned with the O(1) PHILOX formula of
+    // StratifiedKFold::foldOf, so the folds are the same as StratifiedKFold(k, y, seed, quiet, RandomEngine::PHILOX).
+    // Optionally the fold of every sample is written to a file (uint8, or uint16 when k > 255) that is memory
+    // mapped afterwards, otherwise the labels are streamed again each time a fold is read.
+    class StreamingStratifiedKFold {
+    public:
+        using ChunkConsumer = std::function<void(const std::vector<int64_t>& train, const std::vector<int64_t>& test)>;
+        inline StreamingStratifiedKFold(int k, LabelSource& source, int seed = -1, bool quiet = true, const std::string& fold_ids_path = "")
+            : k(k), source(source), seed(seed == -1 ? std::random_device()() : seed)
+        {
+            if (k < 2 || k > 65535) {
+                throw std::invalid_argument("k (" + std::to_string(k) + ") must be in [2, 65535]");
+            }
+            // First pass: class counts
+            forEachLabel([this](int64_t, int label) { classes[label].count++; });
+            for (const auto& [label, state] : classes) {
+                n += state.count;
+                if (state.count < static_cast<uint64_t>(this->k)) {
+                    faulty = true;
+                    if (!quiet)
+                        std::cerr << "Warning! The number of samples in class " << label << " (" << state.count
+                        << ") is less than the number of folds (" << this->k << ")." << std::endl;
+                }
+            }
+            // Second pass, optional: store the fold of every sample
+            if (!fold_ids_path.empty()) {
+                if (k <= 255) {
+                    writeFoldIds<uint8_t>(fold_ids_path);
+                } else {
+                    writeFoldIds<uint16_t>(fold_ids_path);
+                }
+                fold_ids = std::make_shared<MappedFile>(fold_ids_path);
+            }
+        }
+        inline int getNumberOfFolds() const { return k; }
+        inline int64_t getNumberOfSamples() const { return n; }
+        inline bool isFaulty() const { return faulty; }
+        // Calls consumer with the train and test indices of fold nFold, in ascending order, chunk by chunk.
+        // Each call covers the next chunk_size samples, so at most chunk_size indices are held at once.
+        inline void forEachChunk(int nFold, const ChunkConsumer& consumer, size_t chunk_size = 1 << 20)
+        {
+            if (nFold >= k || nFold < 0) {
+                throw std::out_of_range("nFold (" + std::to_string(nFold) + ") must be less than k (" + std::to_string(k) + ")");
+            }
+            auto train = std::vector<int64_t>();
+            auto test = std::vector<int64_t>();
+            train.reserve(chunk_size);
+            test.reserve(chunk_size);
+            int64_t chunk_end = chunk_size;
+            forEachFold([&](int64_t sample, int fold) {
+                if (sample == chunk_end) {
+                    consumer(train, test);
+                    train.clear();
+                    test.clear();
+                    chunk_end += chunk_size;
+                }
+                (fold == nFold ? test : train).push_back(sample);
+                });
+            if (!train.empty() || !test.empty()) {
+                consumer(train, test);
+            }
+        }
+        // Fold of every sample, in sample order
+        inline void forEachFold(const std::function<void(int64_t sample, int fold)>& visit)
+        {
+            if (!fold_ids) {
+                for (auto& [label, state] : classes) {
+                    state.rank = 0;
+                }
+                forEachLabel([&](int64_t sample, int label) { visit(sample, foldOf(label)); });
+            } else if (k <= 255) {
+                auto ids = reinterpret_cast<const uint8_t*>(fold_ids->data());
+                for (int64_t sample = 0; sample < n; ++sample) {
+                    visit(sample, ids[sample]);
+                }
+            } else {
+                auto ids = reinterpret_cast<const uint16_t*>(fold_ids->data());
+                for (int64_t sample = 0; sample < n; ++sample) {
+                    visit(sample, ids[sample]);
+                }
+            }
+        }
+    private:
+        struct ClassState {
+            uint64_t count = 0;
+            uint64_t rank = 0; // Samples of the class seen in the current pass
+        };
+        static constexpr size_t read_size = 1 << 16;
+        int k;
+        LabelSource& source;
+        uint32_t seed;
+        int64_t n = 0;
+        bool faulty = false;
+        std::map<int, ClassState> classes;
+        std::shared_ptr<MappedFile> fold_ids;
+        inline void forEachLabel(const std::function<void(int64_t sample, int label)>& visit)
+        {
+            auto buffer = std::vector<int>(read_size);
+            int64_t sample = 0;
+            source.rewind();
+            for (size_t count = source.read(buffer.data(), read_size); count > 0; count = source.read(buffer.data(), read_size)) {
+                for (size_t i = 0; i < count; ++i) {
+                    visit(sample++, buffer[i]);
+                }
+            }
+        }
+        inline int foldOf(int label)
+        {
+            auto& state = classes.at(label);
+            return StratifiedKFold::foldOf(k, seed, label, state.count, state.rank++);
+        }
+        template <typename FoldId>
+        void writeFoldIds(const std::string& path)
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                throw std::runtime_error("Unable to create file " + path);
+            }
+            auto buffer = std::vector<FoldId>();
+            buffer.reserve(read_size);
+            forEachFold([&](int64_t, int fold) {
+                buffer.push_back(static_cast<FoldId>(fold));
+                if (buffer.size() == read_size) {
+                    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(FoldId));
+                    buffer.clear();
+                }
+                });
+            file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(FoldId));
+            if (!file) {
+                throw std::runtime_error("Unable to write file " + path);
+            }
+        }
+    };
+    // Part of a split computed by one of world_size processes. With ShardBy::FOLDS the process owns the folds
+    // f with f % world_size == rank, whole; with ShardBy::ROWS it owns every fold restricted to a contiguous
+    // range of the samples, the rank-th of world_size ranges of (almost) the same size.
+    enum class ShardBy { FOLDS, ROWS };
+    struct Shard {
+        int rank = 0;
+        int world_size = 1;
+        ShardBy by = ShardBy::FOLDS;
+        inline bool ownsFold(int fold) const { return by == ShardBy::ROWS || fold % world_size == rank; }
+        inline SampleRange rows(int64_t n) const
+        {
+            if (by == ShardBy::FOLDS) {
+                return { 0, n };
+            }
+            return { n * rank / world_size, n * (rank + 1) / world_size };
+        }
+    };
+    // Base of the sharded splits. The fold of every sample is computed on its own with the PHILOX engine, so
+    // each process gets the same folds as the single process split with the same seed without communicating
+    // and without building the whole split: only the samples of its rows are stored, in CSR layout with the
+    // samples of each fold in ascending order. The views of a fold hold its train and test samples in the rows.
+    // The folds of the shard are numbered 0, 1, ... in the Fold interface, so iterating, CrossValidator and
+    // getFoldIds only see them; getFolds maps them back to the folds of the split.
+    template <typename Index>
+    class BasicShardedFold : public BasicFold<Index> {
+    public:
+        using typename BasicFold<Index>::FoldView;
+        inline FoldView getFoldView(int nFold) override
+        {
+            this->checkFold(nFold);
+            return this->makeView(indices.data(), indices.size(), offsets[nFold], offsets[nFold + 1]);
+        }
+        inline const Shard& getShard() const { return shard; }
+        inline SampleRange getRows() const { return rows; }
+        // Fold of the split that fold i of the shard is, for every i
+        inline const std::vector<int>& getFolds() const { return folds; }
+    protected:
+        Shard shard;
+        SampleRange rows;
+        std::vector<Index> indices;
+        std::vector<Index> offsets;
+        std::vector<int> folds;
+#ifdef FOLDING_INSTRUMENTATION
+        inline size_t allocatedBytes() const override { return (indices.capacity() + offsets.capacity()) * sizeof(Index); }
+#endif
+        inline BasicShardedFold(int k, int64_t n, int seed, Shard shard) : BasicFold<Index>(k, n, seed, RandomEngine::PHILOX), shard(shard)
+        {
+            if (shard.world_size < 1 || shard.rank < 0 || shard.rank >= shard.world_size) {
+                throw std::invalid_argument("rank (" + std::to_string(shard.rank) + ") must be in [0, " + std::to_string(shard.world_size) + ")");
+            }
+            // Every process has to draw the same key
+            if (seed == -1) {
+                throw std::invalid_argument("The shards of a split need a seed shared by all the processes, not -1");
+            }
+            rows = shard.rows(n);
+        }
+        // Writes the rows of every fold in ascending order given the fold of each row in the split, -1 for the
+        // rows that are always in the train set. The folds of the shard go first, then the other folds and the
+        // rows never tested, which are only in the train sets, and k becomes the number of folds of the shard.
+        inline void scatter(const std::vector<int>& row_folds)
+        {
+            int k = this->k;
+            auto slots = std::vector<int>(k);
+            folds.clear();
+            for (int fold = 0; fold < k; ++fold) {
+                if (shard.ownsFold(fold)) {
+                    slots[fold] = folds.size();
+                    folds.push_back(fold);
+                }
+            }
+            for (int fold = 0, slot = folds.size(); fold < k; ++fold) {
+                if (!shard.ownsFold(fold)) {
+                    slots[fold] = slot++;
+                }
+            }
+            offsets = std::vector<Index>(k + 1, 0);
+            for (auto fold : row_folds) {
+                if (fold >= 0) {
+                    offsets[slots[fold] + 1]++;
+                }
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            indices = std::vector<Index>(row_folds.size());
+            auto cursor = std::vector<Index>(offsets.begin(), offsets.end());
+            for (size_t row = 0; row < row_folds.size(); ++row) {
+                auto slot = row_folds[row] < 0 ? k : slots[row_folds[row]];
+                indices[cursor[slot]++] = static_cast<Index>(rows.start + row);
+            }
+            this->k = folds.size();
+            offsets.resize(this->k + 1);
+        }
+    };
+    // Shard of KFold(k, n, seed, RandomEngine::PHILOX), computed in O(rows) from the inverse permutation
+    template <typename Index>
+    class BasicShardedKFold : public BasicShardedFold<Index> {
+    public:
+        inline BasicShardedKFold(int k, int64_t n, int seed, Shard shard) : BasicShardedFold<Index>(k, n, seed, shard)
+        {
+            auto permutation = CounterPermutation(n, this->counter_seed, 0);
+            int64_t nTest = n / k;
+            auto row_folds = std::vector<int>(this->rows.size());
+            for (int64_t row = 0; row < this->rows.size(); ++row) {
+                int64_t position = permutation.inverse(this->rows.start + row);
+                row_folds[row] = position < nTest * k ? position / nTest : -1;
+            }
+            this->scatter(row_folds);
+            this->recordBuild();
+        }
+    };
+    using ShardedKFold = BasicShardedKFold<int>;
+    // Shard of StratifiedKFold(k, y, seed, quiet, RandomEngine::PHILOX). All the labels are read, to count the
+    // classes and the rank of the first row of the shard in its class, but only the folds of the rows are
+    // computed and kept, with StratifiedKFold::foldOf.
+    template <typename Index, typename Label = int>
+    class BasicShardedStratifiedKFold : public BasicShardedFold<Index> {
+    public:
+        inline BasicShardedStratifiedKFold(int k, const std::vector<Label>& y, int seed, Shard shard, bool quiet = true)
+            : BasicShardedFold<Index>(k, y.size(), seed, shard)
+        {
+            build(y.data(), quiet);
+            this->recordBuild(y.data());
+        }
+        inline BasicShardedStratifiedKFold(int k, torch::Tensor& y, int seed, Shard shard, bool quiet = true)
+            : BasicShardedFold<Index>(k, y.numel(), seed, shard)
+        {
+            visitLabels(y, [this, quiet](const auto* labels) {
+                build(labels, quiet);
+                this->recordBuild(labels);
+                });
+        }
+        inline bool isFaulty() const { return faulty; }
+    private:
+        bool faulty = false;
+        template <typename ClassLabel>
+        void build(const ClassLabel* y, bool quiet)
+        {
+            struct ClassState {
+                uint64_t count = 0;
+                uint64_t rank = 0; // Samples of the class before the current one
+            };
+            auto classes = std::map<int64_t, ClassState>();
+            for (int64_t sample = 0; sample < this->n; ++sample) {
+                auto& state = classes[static_cast<int64_t>(y[sample])];
+                state.count++;
+                if (sample < this->rows.start) {
+                    state.rank++;
+                }
+            }
+            for (const auto& [label, state] : classes) {
+                if (state.count < static_cast<uint64_t>(this->k)) {
+                    faulty = true;
+                    if (!quiet)
+                        std::cerr << "Warning! The number of samples in class " << label << " (" << state.count
+                        << ") is less than the number of folds (" << this->k << ")." << std::endl;
+                }
+            }
+            auto row_folds = std::vector<int>(this->rows.size());
+            for (int64_t row = 0; row < this->rows.size(); ++row) {
+                auto label = static_cast<int64_t>(y[this->rows.start + row]);
+                auto& state = classes[label];
+                row_folds[row] = StratifiedKFold::foldOf(this->k, this->counter_seed, label, state.count, state.rank++);
+            }
+            this->scatter(row_folds);
+        }
+    };
+    using ShardedStratifiedKFold = BasicShardedStratifiedKFold<int, int>;
+    // Evaluates a callable (fold, train, test) -> result on every fold of a Fold object using a pool of
+    // worker threads, and returns the results in fold order. Each worker starts with a contiguous share
+    // of the folds and steals pending folds from the other workers once its own queue is empty.
+    class CrossValidator {
+    public:
+        // max_concurrency bounds the number of folds evaluated at the same time, 0 means one per hardware thread.
+        // The torch intra-op threads are split among the workers to avoid oversubscribing the cores. The thread count
+        // is global to torch, so run must not be called concurrently, from this or any other CrossValidator.
+        inline explicit CrossValidator(int max_concurrency = 0) : max_concurrency(max_concurrency)
+        {
+            if (max_concurrency < 0) {
+                throw std::invalid_argument("max_concurrency (" + std::to_string(max_concurrency) + ") must be greater or equal than 0");
+            }
+        }
+        template <typename Index, typename Callable>
+        auto run(BasicFold<Index>& folds, Callable&& callable) -> std::vector<std::invoke_result_t<Callable&, int, const BasicIndexChain<Index>&, const BasicIndexSpan<Index>&>>
+        {
+            using Result = std::invoke_result_t<Callable&, int, const BasicIndexChain<Index>&, const BasicIndexSpan<Index>&>;
+            int nFolds = folds.getNumberOfFolds();
+            int hardware = std::max(1u, std::thread::hardware_concurrency());
+            int workers = std::max(1, std::min(nFolds, max_concurrency == 0 ? hardware : max_concurrency));
+            auto queues = std::vector<std::deque<int>>(workers);
+            for (int fold = 0; fold < nFolds; ++fold) {
+                queues[fold * workers / nFolds].push_back(fold);
+            }
+            auto results = std::vector<std::optional<Result>>(nFolds);
+            std::mutex queues_mutex;
+            std::exception_ptr error;
+            std::atomic<bool> failed{ false };
+            auto next_fold = [&](int worker) {
+                std::lock_guard<std::mutex> lock(queues_mutex);
+                if (!queues[worker].empty()) {
+                    int fold = queues[worker].front();
+                    queues[worker].pop_front();
+                    return fold;
+                }
+                // Steal from the back of the fullest queue
+                auto victim = std::max_element(queues.begin(), queues.end(), [](const auto& a, const auto& b) { return a.size() < b.size(); });
+                if (victim->empty()) {
+                    return -1;
+                }
+                int fold = victim->back();
+                victim->pop_back();
+                return fold;
+            };
+            IntraOpThreads intra_op_threads(std::max(1, hardware / workers));
+            auto work = [&](int worker) {
+                at::init_num_threads();
+                for (int fold = next_fold(worker); fold != -1 && !failed; fold = next_fold(worker)) {
+                    try {
+                        auto view = folds.getFoldView(fold);
+                        results[fold].emplace(callable(fold, view.train, view.test));
+                    }
+                    catch (...) {
+                        std::lock_guard<std::mutex> lock(queues_mutex);
+                        if (!failed.exchange(true)) {
+                            error = std::current_exception();
+                        }
+                    }
+                }
+            };
+            {
+                Joiner threads;
+                try {
+                    for (int worker = 1; worker < workers; ++worker) {
+                        threads.list.emplace_back(work, worker);
+                    }
+                }
+                catch (...) {
+                    // Stop the workers already started and report the failure once they are joined
+                    std::lock_guard<std::mutex> lock(queues_mutex);
+                    if (!failed.exchange(true)) {
+                        error = std::current_exception();
+                    }
+                }
+                work(0);
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            auto output = std::vector<Result>();
+            output.reserve(nFolds);
+            for (auto& result : results) {
+                output.push_back(std::move(*result));
+            }
+            return output;
+        }
+    private:
+        // Sets the torch intra-op thread count for the lifetime of the object
+        struct IntraOpThreads {
+            int previous = torch::get_num_threads();
+            inline explicit IntraOpThreads(int threads) { torch::set_num_threads(threads); }
+            inline ~IntraOpThreads() { torch::set_num_threads(previous); }
+            IntraOpThreads(const IntraOpThreads&) = delete;
+            IntraOpThreads& operator=(const IntraOpThreads&) = delete;
+        };
+        // Joins the workers on every way out of the scope
+        struct Joiner {
+            std::vector<std::thread> list;
+            inline ~Joiner()
+            {
+                for (auto& thread : list) {
+                    thread.join();
+                }
+            }
+        };
+        int max_concurrency;
     };
 }
\ No newline at end of file
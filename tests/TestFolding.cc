@@ -10,6 +10,7 @@
 #include "TestUtils.h"
 #include "folding.hpp"
 #include <folding_config.h>
+#include <sys/wait.h>
 
 TEST_CASE("Version Test", "[Folding]")
 {
@@ -221,4 +222,1060 @@ TEST_CASE("Stratified KFold quiet parameter", "[Folding]")
         REQUIRE(capturedOutput.str() == expected);
         REQUIRE(stratified_kfold.isFaulty());
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Fold views", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    folding::KFold kfold(nFolds, raw.nSamples, 19);
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17);
+    auto check_views = [&](folding::Fold& fold_object) {
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = fold_object.getFold(fold);
+            auto view = fold_object.getFoldView(fold);
+            REQUIRE(view.train.size() == train.size());
+            REQUIRE(view.test.size() == test.size());
+            REQUIRE(std::vector<int>(view.train.begin(), view.train.end()) == train);
+            REQUIRE(std::vector<int>(view.test.begin(), view.test.end()) == test);
+            for (size_t i = 0; i < train.size(); ++i) {
+                REQUIRE(view.train[i] == train[i]);
+            }
+            // All the views of a fold share the same permutation
+            REQUIRE(view.train.head().data() == fold_object.getFoldView(0).train.head().data());
+            REQUIRE(view.train.head().end() == view.test.begin());
+            REQUIRE(view.test.end() == view.train.tail().begin());
+        }
+        REQUIRE_THROWS_AS(fold_object.getFoldView(nFolds), std::out_of_range);
+        REQUIRE_THROWS_AS(fold_object.getFoldView(-1), std::out_of_range);
+    };
+    SECTION("KFold views") { check_views(kfold); }
+    SECTION("StratifiedKFold views") { check_views(stratified_kfold); }
+}
+TEST_CASE("Permutation and offsets layout", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    folding::KFold kfold(nFolds, raw.nSamples, 19);
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17);
+    for (folding::PermutationFold* fold_object : std::vector<folding::PermutationFold*>{ &kfold, &stratified_kfold }) {
+        auto permutation = std::vector<int>(fold_object->getPermutation().begin(), fold_object->getPermutation().end());
+        auto offsets = std::vector<int>(fold_object->getOffsets().begin(), fold_object->getOffsets().end());
+        REQUIRE(offsets.size() == nFolds + 1);
+        REQUIRE(offsets.front() == 0);
+        REQUIRE(std::is_sorted(offsets.begin(), offsets.end()));
+        REQUIRE(permutation.size() == raw.nSamples);
+        // Every sample appears exactly once in the permutation
+        std::sort(permutation.begin(), permutation.end());
+        for (int i = 0; i < raw.nSamples; ++i) {
+            REQUIRE(permutation[i] == i);
+        }
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto view = fold_object->getFoldView(fold);
+            REQUIRE(view.test.data() == fold_object->getPermutation().data() + offsets[fold]);
+            REQUIRE(view.test.size() == offsets[fold + 1] - offsets[fold]);
+        }
+    }
+    REQUIRE(stratified_kfold.getOffsets().back() == raw.nSamples);
+}
+TEST_CASE("Fold tensors", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    folding::KFold kfold(nFolds, raw.nSamples, 19);
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yt, 17);
+    for (folding::Fold* fold_object : std::vector<folding::Fold*>{ &kfold, &stratified_kfold }) {
+        auto data = folding::FoldData();
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = fold_object->getFold(fold);
+            auto [train_t, test_t] = fold_object->getFoldTensor(fold);
+            REQUIRE(train_t.scalar_type() == torch::kInt64);
+            REQUIRE(test_t.scalar_type() == torch::kInt64);
+            REQUIRE(train_t.equal(torch::tensor(train, torch::kInt64)));
+            REQUIRE(test_t.equal(torch::tensor(test, torch::kInt64)));
+            fold_object->getFoldData(fold, raw.Xt, raw.yt, data);
+            REQUIRE(data.train_indices.equal(train_t));
+            REQUIRE(data.test_indices.equal(test_t));
+            REQUIRE(data.X_train.equal(raw.Xt.index_select(1, train_t)));
+            REQUIRE(data.X_test.equal(raw.Xt.index_select(1, test_t)));
+            REQUIRE(data.y_train.equal(raw.yt.index_select(0, train_t)));
+            REQUIRE(data.y_test.equal(raw.yt.index_select(0, test_t)));
+        }
+    }
+    SECTION("Samples in rows")
+    {
+        auto X = raw.Xt.t().contiguous();
+        auto data = kfold.getFoldData(0, X, raw.yt, 0);
+        auto [train_t, test_t] = kfold.getFoldTensor(0);
+        REQUIRE(data.X_train.equal(X.index_select(0, train_t)));
+        REQUIRE(data.X_test.equal(X.index_select(0, test_t)));
+    }
+}
+TEST_CASE("Class grouping", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "glass", "mfeat-fourier");
+    INFO("File Name: " << file_name);
+    auto raw = RawDatasets(file_name, true);
+    auto by_map = folding::groupByClassMap(raw.yv.data(), raw.nSamples);
+    auto by_counting = folding::groupByClassCounting(raw.yv.data(), raw.nSamples, raw.classNumStates);
+    REQUIRE(by_map.labels == by_counting.labels);
+    REQUIRE(by_map.offsets == by_counting.offsets);
+    REQUIRE(by_map.indices == by_counting.indices);
+    REQUIRE(by_map.numberOfClasses() == raw.classNumStates);
+    SECTION("Sparse and negative labels")
+    {
+        auto y = std::vector<int>{ 7, -3, 1000, 7, -3, 7 };
+        auto groups = folding::groupByClass(y.data(), y.size());
+        REQUIRE(groups.labels == std::vector<int>{ -3, 7, 1000 });
+        REQUIRE(groups.offsets == std::vector<int>{ 0, 2, 5, 6 });
+        REQUIRE(groups.indices == std::vector<int>{ 1, 4, 0, 3, 5, 2 });
+    }
+    SECTION("Dense labels with empty classes")
+    {
+        auto y = std::vector<int>{ 3, 0, 3, 0, 5, 3 };
+        auto groups = folding::groupByClass(y.data(), y.size());
+        REQUIRE(groups.labels == std::vector<int>{ 0, 3, 5 });
+        REQUIRE(groups.offsets == std::vector<int>{ 0, 2, 5, 6 });
+        REQUIRE(groups.indices == std::vector<int>{ 1, 3, 0, 2, 5, 4 });
+    }
+}
+TEST_CASE("Cross validator", "[Folding]")
+{
+    auto raw = RawDatasets("diabetes", true);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    int max_concurrency = GENERATE(0, 1, 4);
+    INFO("Max concurrency: " << max_concurrency);
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17);
+    folding::CrossValidator validator(max_concurrency);
+    std::atomic<int> running{ 0 };
+    std::atomic<int> peak{ 0 };
+    auto results = validator.run(stratified_kfold, [&](int fold, const folding::IndexChain& train, const folding::IndexSpan& test) {
+        int now = ++running;
+        int previous = peak;
+        while (now > previous && !peak.compare_exchange_weak(previous, now));
+        auto sizes = std::make_tuple(fold, train.size(), test.size());
+        --running;
+        return sizes;
+        });
+    REQUIRE(results.size() == nFolds);
+    for (int fold = 0; fold < nFolds; ++fold) {
+        auto [train, test] = stratified_kfold.getFold(fold);
+        REQUIRE(std::get<0>(results[fold]) == fold);
+        REQUIRE(std::get<1>(results[fold]) == train.size());
+        REQUIRE(std::get<2>(results[fold]) == test.size());
+    }
+    if (max_concurrency > 0) {
+        REQUIRE(peak <= max_concurrency);
+    }
+    SECTION("Exceptions are propagated")
+    {
+        auto failing = [](int fold, const folding::IndexChain&, const folding::IndexSpan&) {
+            if (fold == 1) {
+                throw std::runtime_error("fold 1 failed");
+            }
+            return fold;
+            };
+        int intra_op_threads = torch::get_num_threads();
+        REQUIRE_THROWS_WITH(validator.run(stratified_kfold, failing), "fold 1 failed");
+        // The torch thread count is restored on the way out
+        REQUIRE(torch::get_num_threads() == intra_op_threads);
+    }
+    REQUIRE_THROWS_AS(folding::CrossValidator(-1), std::invalid_argument);
+}
+TEST_CASE("Repeated folds", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    int repeats = 4;
+    folding::RepeatedKFold repeated_kfold(nFolds, raw.nSamples, repeats, 19);
+    folding::RepeatedStratifiedKFold repeated_stratified(nFolds, raw.yv, repeats, 17);
+    REQUIRE(repeated_kfold.getNumberOfFolds() == nFolds * repeats);
+    REQUIRE(repeated_stratified.getNumberOfFolds() == nFolds * repeats);
+    REQUIRE(repeated_stratified.getNumberOfRepeats() == repeats);
+    REQUIRE(repeated_stratified.getFoldsPerRepeat() == nFolds);
+    SECTION("Each repetition matches a single fold object built with its seed")
+    {
+        for (int repeat = 0; repeat < repeats; ++repeat) {
+            folding::KFold kfold(nFolds, raw.nSamples, repeated_kfold.getRepeatSeed(repeat));
+            folding::StratifiedKFold stratified_kfold(nFolds, raw.yt, repeated_stratified.getRepeatSeed(repeat));
+            for (int fold = 0; fold < nFolds; ++fold) {
+                REQUIRE(repeated_kfold.getFold(repeat * nFolds + fold) == kfold.getFold(fold));
+                REQUIRE(repeated_stratified.getFold(repeat * nFolds + fold) == stratified_kfold.getFold(fold));
+            }
+            REQUIRE(repeated_stratified.isFaulty() == stratified_kfold.isFaulty());
+        }
+    }
+    SECTION("Repetitions are different and independent of the number of threads")
+    {
+        REQUIRE(repeated_stratified.getFold(0) != repeated_stratified.getFold(nFolds));
+        for (int threads : { 1, 3 }) {
+            folding::RepeatedKFold kfold_threads(nFolds, raw.nSamples, repeats, 19, threads);
+            folding::RepeatedStratifiedKFold stratified_threads(nFolds, raw.yt, repeats, 17, true, threads);
+            for (int fold = 0; fold < nFolds * repeats; ++fold) {
+                REQUIRE(kfold_threads.getFold(fold) == repeated_kfold.getFold(fold));
+                REQUIRE(stratified_threads.getFold(fold) == repeated_stratified.getFold(fold));
+            }
+        }
+    }
+    REQUIRE_THROWS_AS(folding::RepeatedKFold(nFolds, raw.nSamples, 0, 19), std::invalid_argument);
+    REQUIRE_THROWS_AS(repeated_kfold.getFoldView(nFolds * repeats), std::out_of_range);
+}
+TEST_CASE("Counter based random engine", "[Folding]")
+{
+    SECTION("Philox4x32-10 known answers")
+    {
+        using Block = folding::Philox::Block;
+        REQUIRE(folding::Philox::generate({ 0, 0, 0, 0 }, { 0, 0 }) == Block{ 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 });
+        REQUIRE(folding::Philox::generate({ 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, { 0xffffffff, 0xffffffff }) == Block{ 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd });
+        REQUIRE(folding::Philox::generate({ 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, { 0xa4093822, 0x299f31d0 }) == Block{ 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 });
+    }
+    SECTION("Counter permutation is a bijection")
+    {
+        uint64_t size = GENERATE(1, 2, 3, 17, 1000, 65537);
+        auto permutation = folding::CounterPermutation(size, 7, 3);
+        auto seen = std::vector<int>(size, 0);
+        for (uint64_t position = 0; position < size; ++position) {
+            auto value = permutation(position);
+            REQUIRE(value < size);
+            REQUIRE(permutation.inverse(value) == position);
+            seen[value]++;
+        }
+        REQUIRE(std::count(seen.begin(), seen.end(), 1) == size);
+    }
+    SECTION("Same folds on every platform")
+    {
+        folding::KFold kfold(3, 10, 42, folding::RandomEngine::PHILOX);
+        auto kfold_permutation = kfold.getPermutation();
+        REQUIRE(std::vector<int>(kfold_permutation.begin(), kfold_permutation.end()) == std::vector<int>{ 6, 3, 7, 4, 8, 1, 0, 2, 5, 9 });
+        auto y = std::vector<int>{ 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 0 };
+        folding::StratifiedKFold stratified_kfold(3, y, 42, true, folding::RandomEngine::PHILOX);
+        auto stratified_permutation = stratified_kfold.getPermutation();
+        auto stratified_offsets = stratified_kfold.getOffsets();
+        REQUIRE(std::vector<int>(stratified_permutation.begin(), stratified_permutation.end()) == std::vector<int>{ 6, 5, 10, 0, 4, 1, 8, 11, 2, 7, 3, 9 });
+        REQUIRE(std::vector<int>(stratified_offsets.begin(), stratified_offsets.end()) == std::vector<int>{ 0, 3, 7, 12 });
+    }
+    SECTION("Fold of a sample without the split")
+    {
+        std::string file_name = GENERATE("iris", "diabetes", "glass");
+        INFO("File Name: " << file_name);
+        int nFolds = GENERATE(3, 10);
+        INFO("Number of Folds: " << nFolds);
+        auto raw = RawDatasets(file_name, true);
+        folding::KFold kfold(nFolds, raw.nSamples, 19, folding::RandomEngine::PHILOX);
+        folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17, true, folding::RandomEngine::PHILOX);
+        REQUIRE(kfold.getRandomEngine() == folding::RandomEngine::PHILOX);
+        auto kfold_of = std::vector<int>(raw.nSamples, -1);
+        auto stratified_of = std::vector<int>(raw.nSamples, -1);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = kfold.getFold(fold);
+            REQUIRE(train.size() + test.size() == raw.nSamples);
+            for (auto sample : test) {
+                kfold_of[sample] = fold;
+            }
+            for (auto sample : stratified_kfold.getFold(fold).second) {
+                stratified_of[sample] = fold;
+            }
+        }
+        auto class_sizes = std::vector<int>(raw.classNumStates, 0);
+        for (auto label : raw.yv) {
+            class_sizes[label]++;
+        }
+        auto ranks = std::vector<int>(raw.classNumStates, 0);
+        for (int sample = 0; sample < raw.nSamples; ++sample) {
+            REQUIRE(kfold.foldOf(sample) == kfold_of[sample]);
+            auto label = raw.yv[sample];
+            REQUIRE(folding::StratifiedKFold::foldOf(nFolds, 17, label, class_sizes[label], ranks[label]++) == stratified_of[sample]);
+        }
+    }
+}
+TEST_CASE("Save and load folds", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    auto engine = GENERATE(folding::RandomEngine::MT19937, folding::RandomEngine::PHILOX);
+    folding::KFold kfold(nFolds, raw.nSamples, 19, engine);
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17, true, engine);
+    auto kfold_file = "kfold_" + file_name + ".fold";
+    auto stratified_file = "stratkfold_" + file_name + ".fold";
+    kfold.save(kfold_file);
+    stratified_kfold.save(stratified_file);
+    auto loaded_kfold = folding::KFold::load(kfold_file);
+    auto loaded_stratified = folding::StratifiedKFold::load(stratified_file, raw.yv);
+    REQUIRE(loaded_kfold.getNumberOfFolds() == nFolds);
+    REQUIRE(loaded_kfold.getRandomEngine() == engine);
+    REQUIRE(loaded_stratified.isFaulty() == stratified_kfold.isFaulty());
+    REQUIRE(loaded_stratified.labelHash() == stratified_kfold.labelHash());
+    for (int fold = 0; fold < nFolds; ++fold) {
+        REQUIRE(loaded_kfold.getFold(fold) == kfold.getFold(fold));
+        REQUIRE(loaded_stratified.getFold(fold) == stratified_kfold.getFold(fold));
+    }
+    SECTION("Wrong files and labels")
+    {
+        auto other_labels = raw.yv;
+        std::swap(other_labels.front(), other_labels.back());
+        other_labels.front() = (other_labels.front() + 1) % raw.classNumStates;
+        REQUIRE_THROWS_AS(folding::StratifiedKFold::load(stratified_file, other_labels), std::invalid_argument);
+        REQUIRE_THROWS_AS(folding::KFold::load(stratified_file), std::invalid_argument);
+        REQUIRE_THROWS_AS(folding::KFold::load("missing.fold"), std::runtime_error);
+        // An offset past the permutation
+        std::fstream file(kfold_file, std::ios::binary | std::ios::in | std::ios::out);
+        int offset = 1000000;
+        file.seekp(sizeof(folding::FoldFileHeader) + sizeof(int));
+        file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        file.close();
+        REQUIRE_THROWS_WITH(folding::KFold::load(kfold_file), "File " + kfold_file + " holds invalid fold offsets");
+    }
+    SECTION("Random seed")
+    {
+        // The key drawn for seed -1 is saved, so the loaded folds agree with foldOf
+        folding::KFold random_kfold(nFolds, raw.nSamples, -1, engine);
+        random_kfold.save(kfold_file);
+        auto loaded = folding::KFold::load(kfold_file);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            REQUIRE(loaded.getFold(fold) == random_kfold.getFold(fold));
+            for (auto sample : loaded.getFoldView(fold).test) {
+                REQUIRE(loaded.foldOf(sample) == fold);
+            }
+        }
+    }
+    std::remove(kfold_file.c_str());
+    std::remove(stratified_file.c_str());
+}
+TEST_CASE("Fold iteration with reusable buffers", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    folding::KFold kfold(nFolds, raw.nSamples, 19);
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17);
+    for (folding::Fold* fold_object : std::vector<folding::Fold*>{ &kfold, &stratified_kfold }) {
+        int expected_fold = 0;
+        const int* train_buffer = nullptr;
+        const int* test_buffer = nullptr;
+        for (const auto& split : *fold_object) {
+            REQUIRE(split.fold == expected_fold);
+            auto [train, test] = fold_object->getFold(expected_fold++);
+            REQUIRE(split.train == train);
+            REQUIRE(split.test == test);
+            // The buffers are never reallocated
+            if (train_buffer == nullptr) {
+                train_buffer = split.train.data();
+                test_buffer = split.test.data();
+            }
+            REQUIRE(split.train.data() == train_buffer);
+            REQUIRE(split.test.data() == test_buffer);
+        }
+        REQUIRE(expected_fold == nFolds);
+        SECTION("Output references")
+        {
+            auto train = std::vector<int>();
+            auto test = std::vector<int>();
+            train.reserve(raw.nSamples);
+            test.reserve(raw.nSamples);
+            auto train_data = train.data();
+            auto test_data = test.data();
+            for (int fold = nFolds - 1; fold >= 0; --fold) {
+                fold_object->getFold(fold, train, test);
+                REQUIRE(std::make_pair(train, test) == fold_object->getFold(fold));
+                REQUIRE(train.data() == train_data);
+                REQUIRE(test.data() == test_data);
+            }
+        }
+    }
+}
+TEST_CASE("Streaming stratified KFold", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 10);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    auto labels_file = "labels_" + file_name + ".bin";
+    auto fold_ids_file = "fold_ids_" + file_name + ".bin";
+    {
+        std::ofstream file(labels_file, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(raw.yv.data()), raw.yv.size() * sizeof(int));
+    }
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17, true, folding::RandomEngine::PHILOX);
+    folding::VectorLabelSource vector_source(raw.yv);
+    folding::MappedLabelSource mapped_source(labels_file);
+    folding::StreamingStratifiedKFold from_labels(nFolds, vector_source, 17);
+    folding::StreamingStratifiedKFold from_fold_ids(nFolds, mapped_source, 17, true, fold_ids_file);
+    for (auto streaming : { &from_labels, &from_fold_ids }) {
+        REQUIRE(streaming->getNumberOfFolds() == nFolds);
+        REQUIRE(streaming->getNumberOfSamples() == raw.nSamples);
+        REQUIRE(streaming->isFaulty() == stratified_kfold.isFaulty());
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = stratified_kfold.getFold(fold);
+            std::sort(train.begin(), train.end());
+            std::sort(test.begin(), test.end());
+            auto streamed_train = std::vector<int>();
+            auto streamed_test = std::vector<int>();
+            size_t chunk_size = 50;
+            streaming->forEachChunk(fold, [&](const std::vector<int64_t>& train_chunk, const std::vector<int64_t>& test_chunk) {
+                REQUIRE(train_chunk.size() + test_chunk.size() <= chunk_size);
+                streamed_train.insert(streamed_train.end(), train_chunk.begin(), train_chunk.end());
+                streamed_test.insert(streamed_test.end(), test_chunk.begin(), test_chunk.end());
+                }, chunk_size);
+            REQUIRE(streamed_train == train);
+            REQUIRE(streamed_test == test);
+        }
+    }
+    REQUIRE_THROWS_AS(from_labels.forEachChunk(nFolds, [](const std::vector<int64_t>&, const std::vector<int64_t>&) {}), std::out_of_range);
+    std::remove(labels_file.c_str());
+    std::remove(fold_ids_file.c_str());
+}
+TEST_CASE("Index and label types", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    auto engine = GENERATE(folding::RandomEngine::MT19937, folding::RandomEngine::PHILOX);
+    auto raw = RawDatasets(file_name, true);
+    int nFolds = 5;
+    SECTION("KFold")
+    {
+        folding::KFold kfold(nFolds, raw.nSamples, 17, engine);
+        folding::BasicKFold<uint16_t> narrow_kfold(nFolds, raw.nSamples, 17, engine);
+        folding::BasicKFold<int64_t> wide_kfold(nFolds, raw.nSamples, 17, engine);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = kfold.getFold(fold);
+            auto [narrow_train, narrow_test] = narrow_kfold.getFold(fold);
+            auto [wide_train, wide_test] = wide_kfold.getFold(fold);
+            REQUIRE(std::vector<int>(narrow_train.begin(), narrow_train.end()) == train);
+            REQUIRE(std::vector<int>(narrow_test.begin(), narrow_test.end()) == test);
+            REQUIRE(std::vector<int>(wide_train.begin(), wide_train.end()) == train);
+            REQUIRE(std::vector<int>(wide_test.begin(), wide_test.end()) == test);
+        }
+    }
+    SECTION("StratifiedKFold")
+    {
+        folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17, true, engine);
+        auto y64 = std::vector<int64_t>(raw.yv.begin(), raw.yv.end());
+        folding::BasicStratifiedKFold<uint32_t, int64_t> wide_labels(nFolds, y64, 17, true, engine);
+        auto y_int64 = raw.yt.to(torch::kInt64);
+        auto y_uint8 = raw.yt.to(torch::kUInt8);
+        folding::StratifiedKFold from_int64(nFolds, y_int64, 17, true, engine);
+        folding::StratifiedKFold from_uint8(nFolds, y_uint8, 17, true, engine);
+        REQUIRE(wide_labels.labelHash() == stratified_kfold.labelHash());
+        REQUIRE(from_uint8.labelHash() == stratified_kfold.labelHash());
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = stratified_kfold.getFold(fold);
+            auto [wide_train, wide_test] = wide_labels.getFold(fold);
+            REQUIRE(std::vector<int>(wide_train.begin(), wide_train.end()) == train);
+            REQUIRE(std::vector<int>(wide_test.begin(), wide_test.end()) == test);
+            REQUIRE(from_int64.getFold(fold) == std::make_pair(train, test));
+            REQUIRE(from_uint8.getFold(fold) == std::make_pair(train, test));
+        }
+    }
+    SECTION("Save and load")
+    {
+        folding::BasicStratifiedKFold<uint32_t, int64_t> stratified_kfold(nFolds, std::vector<int64_t>(raw.yv.begin(), raw.yv.end()), 17, true, engine);
+        auto path = "folds_" + file_name + ".bin";
+        stratified_kfold.save(path);
+        auto loaded = folding::BasicStratifiedKFold<uint32_t, int64_t>::load(path);
+        auto permutation = stratified_kfold.getPermutation();
+        auto loaded_permutation = loaded.getPermutation();
+        REQUIRE(std::equal(permutation.begin(), permutation.end(), loaded_permutation.begin(), loaded_permutation.end()));
+        REQUIRE_THROWS_AS(folding::StratifiedKFold::load(path), std::invalid_argument);
+        std::remove(path.c_str());
+    }
+    SECTION("Errors")
+    {
+        REQUIRE_THROWS_AS(folding::BasicKFold<uint8_t>(nFolds, 300), std::invalid_argument);
+        auto y_float = raw.yt.to(torch::kFloat32);
+        REQUIRE_THROWS_WITH(folding::StratifiedKFold(nFolds, y_float), "Labels must be an integer tensor");
+    }
+}
+TEST_CASE("Group folds", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    int nFolds = GENERATE(3, 5);
+    INFO("Number of Folds: " << nFolds);
+    auto raw = RawDatasets(file_name, true);
+    // Groups of three consecutive rows, as many rows of the same patient
+    auto groups = std::vector<int>(raw.nSamples);
+    for (int row = 0; row < raw.nSamples; ++row) {
+        groups[row] = 1000 + row / 3;
+    }
+    auto groups_tensor = torch::tensor(groups, torch::kInt64);
+    auto check_groups = [&](folding::Fold& folds) {
+        auto fold_of_group = std::map<int, int>();
+        auto tested = std::vector<int>(raw.nSamples, 0);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = folds.getFold(fold);
+            REQUIRE(train.size() + test.size() == raw.nSamples);
+            REQUIRE(std::is_sorted(test.begin(), test.end()));
+            for (auto row : test) {
+                tested[row]++;
+                auto [it, inserted] = fold_of_group.try_emplace(groups[row], fold);
+                REQUIRE(it->second == fold);
+            }
+        }
+        REQUIRE(std::all_of(tested.begin(), tested.end(), [](int count) { return count == 1; }));
+    };
+    SECTION("GroupKFold")
+    {
+        folding::GroupKFold group_kfold(nFolds, groups);
+        check_groups(group_kfold);
+        // Every group has at most three rows, so the greedy assignment keeps the folds within three rows
+        auto sizes = std::vector<size_t>();
+        for (int fold = 0; fold < nFolds; ++fold) {
+            sizes.push_back(group_kfold.getFoldView(fold).test.size());
+        }
+        auto [smallest, largest] = std::minmax_element(sizes.begin(), sizes.end());
+        REQUIRE(*largest - *smallest <= 3);
+        folding::GroupKFold from_tensor(nFolds, groups_tensor);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            REQUIRE(from_tensor.getFold(fold) == group_kfold.getFold(fold));
+        }
+    }
+    SECTION("StratifiedGroupKFold")
+    {
+        folding::StratifiedGroupKFold stratified_group_kfold(nFolds, raw.yv, groups);
+        check_groups(stratified_group_kfold);
+        folding::StratifiedGroupKFold from_tensor(nFolds, raw.yt, groups_tensor);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            REQUIRE(from_tensor.getFold(fold) == stratified_group_kfold.getFold(fold));
+        }
+        // Same class distribution in every fold up to a group of three rows
+        auto class_counts = std::map<int, int>();
+        for (auto label : raw.yv) {
+            class_counts[label]++;
+        }
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto fold_counts = std::map<int, int>();
+            for (auto row : stratified_group_kfold.getFoldView(fold).test) {
+                fold_counts[raw.yv[row]]++;
+            }
+            for (const auto& [label, count] : class_counts) {
+                REQUIRE(std::abs(fold_counts[label] - count / static_cast<double>(nFolds)) <= 3 + nFolds);
+            }
+        }
+        folding::StratifiedGroupKFold shuffled(nFolds, raw.yv, groups, true, 17);
+        check_groups(shuffled);
+    }
+    SECTION("Errors")
+    {
+        auto few_groups = std::vector<int>(raw.nSamples, 1);
+        REQUIRE_THROWS_WITH(folding::GroupKFold(nFolds, few_groups), "Cannot have number of folds (" + std::to_string(nFolds) + ") greater than the number of groups (1)");
+        auto short_groups = std::vector<int>(groups.begin(), groups.end() - 1);
+        REQUIRE_THROWS_AS(folding::StratifiedGroupKFold(nFolds, raw.yv, short_groups), std::invalid_argument);
+    }
+}
+TEST_CASE("Shuffle splits", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    auto raw = RawDatasets(file_name, true);
+    int nSplits = 10;
+    double test_size = GENERATE(0.1, 0.25);
+    INFO("Test size: " << test_size);
+    auto expected_test = static_cast<int>(std::ceil(test_size * raw.nSamples));
+    auto check_split = [&](folding::Fold& folds, int split) {
+        auto [train, test] = folds.getFold(split);
+        REQUIRE(test.size() == expected_test);
+        REQUIRE(train.size() == raw.nSamples - expected_test);
+        auto samples = train;
+        samples.insert(samples.end(), test.begin(), test.end());
+        std::sort(samples.begin(), samples.end());
+        auto all = std::vector<int>(raw.nSamples);
+        std::iota(all.begin(), all.end(), 0);
+        REQUIRE(samples == all);
+    };
+    SECTION("ShuffleSplit")
+    {
+        folding::ShuffleSplit shuffle_split(nSplits, raw.nSamples, test_size, 17);
+        REQUIRE(shuffle_split.getNumberOfFolds() == nSplits);
+        REQUIRE(shuffle_split.getTestSize() == expected_test);
+        for (int split = 0; split < nSplits; ++split) {
+            check_split(shuffle_split, split);
+        }
+        // Every split is the same whatever the order it is asked for
+        auto last = shuffle_split.getFold(nSplits - 1);
+        folding::ShuffleSplit other(nSplits, raw.nSamples, test_size, 17);
+        REQUIRE(other.getFold(nSplits - 1) == last);
+        REQUIRE(other.getFold(0) == shuffle_split.getFold(0));
+    }
+    SECTION("StratifiedShuffleSplit")
+    {
+        folding::StratifiedShuffleSplit stratified_shuffle_split(nSplits, raw.yv, test_size, 17);
+        folding::StratifiedShuffleSplit from_tensor(nSplits, raw.yt, test_size, 17);
+        auto class_counts = std::map<int, int>();
+        for (auto label : raw.yv) {
+            class_counts[label]++;
+        }
+        for (int split = 0; split < nSplits; ++split) {
+            check_split(stratified_shuffle_split, split);
+            auto [train, test] = stratified_shuffle_split.getFold(split);
+            REQUIRE(from_tensor.getFold(split) == std::make_pair(train, test));
+            auto test_counts = std::map<int, int>();
+            for (auto sample : test) {
+                test_counts[raw.yv[sample]]++;
+            }
+            for (const auto& [label, count] : class_counts) {
+                double expected = static_cast<double>(count) * expected_test / raw.nSamples;
+                REQUIRE(test_counts[label] >= std::floor(expected));
+                REQUIRE(test_counts[label] <= std::ceil(expected));
+            }
+        }
+    }
+    SECTION("Parallel splits")
+    {
+        folding::StratifiedShuffleSplit stratified_shuffle_split(nSplits, raw.yv, test_size, 17);
+        folding::CrossValidator cross_validator(4);
+        auto tests = cross_validator.run(stratified_shuffle_split, [](int, const folding::IndexChain&, const folding::IndexSpan& test) {
+            return std::vector<int>(test.begin(), test.end());
+            });
+        for (int split = 0; split < nSplits; ++split) {
+            REQUIRE(tests[split] == stratified_shuffle_split.getFold(split).second);
+        }
+        // The new workers take the arrangements the previous ones left
+        auto again = cross_validator.run(stratified_shuffle_split, [](int, const folding::IndexChain&, const folding::IndexSpan& test) {
+            return std::vector<int>(test.begin(), test.end());
+            });
+        REQUIRE(again == tests);
+    }
+    SECTION("Errors")
+    {
+        REQUIRE_THROWS_AS(folding::ShuffleSplit(nSplits, raw.nSamples, 0.0), std::invalid_argument);
+        REQUIRE_THROWS_AS(folding::ShuffleSplit(nSplits, raw.nSamples, 1.0), std::invalid_argument);
+        REQUIRE_THROWS_AS(folding::ShuffleSplit(0, raw.nSamples, test_size), std::invalid_argument);
+        auto y = raw.yv;
+        y[0] = 1000;
+        REQUIRE_THROWS_AS(folding::StratifiedShuffleSplit(nSplits, y, test_size), std::invalid_argument);
+    }
+}
+TEST_CASE("Nested stratified folds", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    auto engine = GENERATE(folding::RandomEngine::MT19937, folding::RandomEngine::PHILOX);
+    auto raw = RawDatasets(file_name, true);
+    int outer_folds = 5, inner_folds = 3;
+    folding::NestedStratifiedKFold nested(outer_folds, inner_folds, raw.yv, 17, true, engine);
+    folding::StratifiedKFold outer(outer_folds, raw.yv, 17, true, engine);
+    REQUIRE(nested.getNumberOfInnerFolds() == inner_folds);
+    for (int outer_fold = 0; outer_fold < outer_folds; ++outer_fold) {
+        auto [outer_train, outer_test] = outer.getFold(outer_fold);
+        REQUIRE(nested.getFold(outer_fold) == std::make_pair(outer_train, outer_test));
+        // The inner folds are the ones built by hand on the labels of the outer train set, in global indices
+        std::sort(outer_train.begin(), outer_train.end());
+        auto y_train = std::vector<int>();
+        for (auto sample : outer_train) {
+            y_train.push_back(raw.yv[sample]);
+        }
+        folding::StratifiedKFold by_hand(inner_folds, y_train, nested.getInnerSeed(outer_fold), true, engine);
+        auto inner = nested.getInnerFolds(outer_fold);
+        REQUIRE(inner.getNumberOfFolds() == inner_folds);
+        for (int inner_fold = 0; inner_fold < inner_folds; ++inner_fold) {
+            auto [train, test] = by_hand.getFold(inner_fold);
+            std::transform(train.begin(), train.end(), train.begin(), [&](int sample) { return outer_train[sample]; });
+            std::transform(test.begin(), test.end(), test.begin(), [&](int sample) { return outer_train[sample]; });
+            REQUIRE(inner.getFold(inner_fold) == std::make_pair(train, test));
+        }
+    }
+    folding::NestedStratifiedKFold from_tensor(outer_folds, inner_folds, raw.yt, 17, true, engine);
+    REQUIRE(from_tensor.getInnerFolds(1).getFold(2) == nested.getInnerFolds(1).getFold(2));
+    // The inner folds of every outer fold built by the workers of a CrossValidator
+    auto inner_tests = folding::CrossValidator(outer_folds).run(nested, [&](int outer_fold, const folding::IndexChain&, const folding::IndexSpan&) {
+        return nested.getInnerFolds(outer_fold).getFold(0).second;
+        });
+    for (int outer_fold = 0; outer_fold < outer_folds; ++outer_fold) {
+        REQUIRE(inner_tests[outer_fold] == nested.getInnerFolds(outer_fold).getFold(0).second);
+    }
+    REQUIRE_THROWS_AS(nested.getInnerFolds(outer_folds), std::out_of_range);
+    folding::StratifiedKFold& as_outer = nested;
+    REQUIRE_THROWS_WITH(as_outer.append(std::vector<int>(8, 0)), "Cannot append samples to nested folds");
+    REQUIRE(nested.getPermutation().size() == raw.nSamples);
+}
+TEST_CASE("Fold masks", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    auto raw = RawDatasets(file_name, true);
+    int nFolds = GENERATE(3, 7);
+    INFO("Number of Folds: " << nFolds);
+    folding::KFold kfold(nFolds, raw.nSamples, 17);
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, 17);
+    for (auto fold_object : std::vector<folding::Fold*>{ &kfold, &stratified_kfold }) {
+        auto fold_ids = fold_object->getFoldIds();
+        auto wide_fold_ids = fold_object->getFoldIds<uint16_t>();
+        auto words = std::vector<uint64_t>((raw.nSamples + 63) / 64);
+        auto bits = std::vector<uint64_t>();
+        torch::Tensor mask;
+        for (int fold = 0; fold < nFolds; ++fold) {
+            auto [train, test] = fold_object->getFold(fold);
+            fold_object->getFoldMask(fold, bits);
+            fold_object->getFoldMaskTensor(fold, mask);
+            REQUIRE(bits == fold_object->getFoldMask(fold));
+            REQUIRE(mask.scalar_type() == torch::kBool);
+            REQUIRE(mask.sum().item<int64_t>() == test.size());
+            auto sorted_test = std::vector<int64_t>(test.begin(), test.end());
+            std::sort(sorted_test.begin(), sorted_test.end());
+            REQUIRE(torch::masked_select(torch::arange(raw.nSamples), mask).equal(torch::tensor(sorted_test)));
+            for (auto sample : test) {
+                REQUIRE((bits[sample / 64] >> (sample % 64) & 1) == 1);
+                REQUIRE(mask[sample].item<bool>());
+                REQUIRE(fold_ids[sample] == fold);
+            }
+            for (auto sample : train) {
+                REQUIRE((bits[sample / 64] >> (sample % 64) & 1) == 0);
+            }
+            folding::maskFromFoldIds(fold_ids.data(), fold_ids.size(), fold, words.data());
+            REQUIRE(words == bits);
+            folding::maskFromFoldIds(wide_fold_ids.data(), wide_fold_ids.size(), fold, words.data());
+            REQUIRE(words == bits);
+        }
+    }
+    // The last n % k samples of a KFold are never tested
+    auto fold_ids = kfold.getFoldIds();
+    REQUIRE(std::count(fold_ids.begin(), fold_ids.end(), 255) == raw.nSamples % nFolds);
+    folding::RepeatedKFold repeated_kfold(nFolds, raw.nSamples, 2, 17);
+    REQUIRE_THROWS_AS(repeated_kfold.getFoldIds(), std::runtime_error);
+}
+TEST_CASE("Time series splits", "[Folding]")
+{
+    SECTION("Ranges")
+    {
+        // Same splits as scikit-learn's TimeSeriesSplit
+        folding::TimeSeriesSplit expanding(3, 6);
+        for (int fold = 0; fold < 3; ++fold) {
+            auto [train, test] = expanding.getFoldRanges(fold);
+            REQUIRE(train.start == 0);
+            REQUIRE(train.stop == 3 + fold);
+            REQUIRE(test.start == 3 + fold);
+            REQUIRE(test.stop == 4 + fold);
+        }
+        folding::TimeSeriesSplit with_gap(3, 12, 0, 2, 2);
+        auto [train, test] = with_gap.getFoldRanges(0);
+        REQUIRE(train.stop == 4);
+        REQUIRE(test.start == 6);
+        REQUIRE(test.stop == 8);
+        folding::TimeSeriesSplit sliding(3, 12, 3, 2, 2);
+        auto [sliding_train, sliding_test] = sliding.getFold(2);
+        REQUIRE(sliding_train == std::vector<int>({ 5, 6, 7 }));
+        REQUIRE(sliding_test == std::vector<int>({ 10, 11 }));
+    }
+    SECTION("Fold data")
+    {
+        std::string file_name = GENERATE("iris", "diabetes", "glass");
+        INFO("File Name: " << file_name);
+        auto raw = RawDatasets(file_name, true);
+        folding::TimeSeriesSplit time_series_split(4, raw.nSamples, 50, 0, 5);
+        for (int fold = 0; fold < time_series_split.getNumberOfFolds(); ++fold) {
+            auto [train, test] = time_series_split.getFold(fold);
+            REQUIRE(train.size() <= 50);
+            REQUIRE(test.front() - train.back() == 6);
+            auto data = time_series_split.getFoldData(fold, raw.Xt, raw.yt);
+            auto train_tensor = torch::tensor(std::vector<int64_t>(train.begin(), train.end()));
+            auto test_tensor = torch::tensor(std::vector<int64_t>(test.begin(), test.end()));
+            REQUIRE(data.X_train.equal(raw.Xt.index_select(1, train_tensor)));
+            REQUIRE(data.X_test.equal(raw.Xt.index_select(1, test_tensor)));
+            REQUIRE(data.y_train.equal(raw.yt.index_select(0, train_tensor)));
+            REQUIRE(data.y_test.equal(raw.yt.index_select(0, test_tensor)));
+            REQUIRE(data.train_indices.equal(train_tensor));
+            REQUIRE(data.test_indices.equal(test_tensor));
+        }
+    }
+    SECTION("Errors")
+    {
+        REQUIRE_THROWS_WITH(folding::TimeSeriesSplit(5, 5), "Cannot have number of folds (6) greater than the number of samples (5)");
+        REQUIRE_THROWS_AS(folding::TimeSeriesSplit(3, 10, 0, 3, 2), std::invalid_argument);
+        REQUIRE_THROWS_AS(folding::TimeSeriesSplit(3, 10).getFoldRanges(3), std::out_of_range);
+    }
+}
+TEST_CASE("Incremental stratified folds", "[Folding]")
+{
+    auto engine = GENERATE(folding::RandomEngine::MT19937, folding::RandomEngine::PHILOX);
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    auto raw = RawDatasets(file_name, true);
+    int nFolds = 5;
+    auto testFolds = [nFolds](folding::StratifiedKFold& stratified_kfold, size_t n) {
+        auto folds = std::vector<int>(n, -1);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            for (auto sample : stratified_kfold.getFoldView(fold).test) {
+                REQUIRE(folds[sample] == -1);
+                folds[sample] = fold;
+            }
+        }
+        return folds;
+    };
+    // Build on the first half of the samples and append the rest in batches
+    auto half = raw.nSamples / 2;
+    auto y = std::vector<int>(raw.yv.begin(), raw.yv.begin() + half);
+    folding::StratifiedKFold stratified_kfold(nFolds, y, 17, true, engine);
+    auto folds = testFolds(stratified_kfold, y.size());
+    for (auto start = half; start < raw.nSamples; start += 23) {
+        auto batch = std::vector<int>(raw.yv.begin() + start, raw.yv.begin() + std::min(start + 23, raw.nSamples));
+        auto batch_folds = stratified_kfold.append(batch);
+        y.insert(y.end(), batch.begin(), batch.end());
+        auto appended = testFolds(stratified_kfold, y.size());
+        // The samples already there keep their folds
+        REQUIRE(std::equal(folds.begin(), folds.end(), appended.begin()));
+        REQUIRE(std::equal(batch_folds.begin(), batch_folds.end(), appended.begin() + folds.size()));
+        folds = appended;
+    }
+    REQUIRE(stratified_kfold.labelHash() == folding::hashLabels(raw.yv.data(), raw.yv.size()));
+    // Every class is still spread evenly among the folds
+    auto counts = std::map<int, std::vector<int>>();
+    for (size_t sample = 0; sample < y.size(); ++sample) {
+        counts.emplace(y[sample], std::vector<int>(nFolds)).first->second[folds[sample]]++;
+    }
+    for (const auto& [label, class_counts] : counts) {
+        auto [least, most] = std::minmax_element(class_counts.begin(), class_counts.end());
+        REQUIRE(*most - *least <= 1);
+    }
+    stratified_kfold.save("incremental.folds");
+    auto loaded = folding::StratifiedKFold::load("incremental.folds");
+    REQUIRE_THROWS_WITH(loaded.append(y), "Cannot append samples to folds loaded from a file");
+    std::remove("incremental.folds");
+}
+TEST_CASE("Sharded folds", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    auto by = GENERATE(folding::ShardBy::FOLDS, folding::ShardBy::ROWS);
+    INFO("File Name: " << file_name);
+    auto raw = RawDatasets(file_name, true);
+    int nFolds = 5, world_size = 3, seed = 17;
+    // Every process writes the train and test samples of its shard, fold by fold
+    auto shardFile = [](int rank) { return "shard" + std::to_string(rank) + ".folds"; };
+    auto processes = std::vector<pid_t>();
+    for (int rank = 0; rank < world_size; ++rank) {
+        auto pid = fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            // An exception must not unwind into the copy of the test runner
+            try {
+                folding::ShardedStratifiedKFold sharded(nFolds, raw.yv, seed, { rank, world_size, by });
+                std::ofstream file(shardFile(rank), std::ios::binary);
+                for (const auto& split : sharded) {
+                    int fold = sharded.getFolds()[split.fold];
+                    for (const auto* samples : { &split.train, &split.test }) {
+                        int64_t size = samples->size();
+                        file.write(reinterpret_cast<const char*>(&fold), sizeof(fold));
+                        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+                        file.write(reinterpret_cast<const char*>(samples->data()), size * sizeof(int));
+                    }
+                }
+                file.close();
+                _exit(file ? 0 : 1);
+            }
+            catch (...) {
+                _exit(1);
+            }
+        }
+        processes.push_back(pid);
+    }
+    for (auto pid : processes) {
+        int status;
+        REQUIRE(waitpid(pid, &status, 0) == pid);
+        REQUIRE(WIFEXITED(status));
+        REQUIRE(WEXITSTATUS(status) == 0);
+    }
+    // The union of the shards is the single process split
+    auto train = std::vector<std::vector<int>>(nFolds);
+    auto test = std::vector<std::vector<int>>(nFolds);
+    for (int rank = 0; rank < world_size; ++rank) {
+        std::ifstream file(shardFile(rank), std::ios::binary);
+        int fold;
+        int64_t size;
+        for (int part = 0; file.read(reinterpret_cast<char*>(&fold), sizeof(fold)); ++part) {
+            file.read(reinterpret_cast<char*>(&size), sizeof(size));
+            auto& samples = part % 2 == 0 ? train[fold] : test[fold];
+            auto offset = samples.size();
+            samples.resize(offset + size);
+            file.read(reinterpret_cast<char*>(samples.data() + offset), size * sizeof(int));
+        }
+        std::remove(shardFile(rank).c_str());
+    }
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yv, seed, true, folding::RandomEngine::PHILOX);
+    for (int fold = 0; fold < nFolds; ++fold) {
+        auto [expected_train, expected_test] = stratified_kfold.getFold(fold);
+        for (auto* samples : { &expected_train, &expected_test, &train[fold], &test[fold] }) {
+            std::sort(samples->begin(), samples->end());
+        }
+        REQUIRE(train[fold] == expected_train);
+        REQUIRE(test[fold] == expected_test);
+    }
+    // The shards of a KFold are computed without the labels
+    folding::ShardedKFold sharded_kfold(nFolds, raw.nSamples, seed, { 1, world_size, folding::ShardBy::FOLDS });
+    folding::KFold kfold(nFolds, raw.nSamples, seed, folding::RandomEngine::PHILOX);
+    // Its folds 1 and 4 are folds 0 and 1 of the shard
+    REQUIRE(sharded_kfold.getFolds() == std::vector<int>({ 1, 4 }));
+    REQUIRE(sharded_kfold.getNumberOfFolds() == 2);
+    auto [kfold_train, kfold_test] = kfold.getFold(4);
+    std::sort(kfold_test.begin(), kfold_test.end());
+    REQUIRE(sharded_kfold.getFold(1).second == kfold_test);
+    REQUIRE_THROWS_AS(sharded_kfold.getFoldView(2), std::out_of_range);
+    auto ids = sharded_kfold.getFoldIds();
+    for (auto sample : kfold_test) {
+        REQUIRE(ids[sample] == 1);
+    }
+    auto sizes = folding::CrossValidator(2).run(sharded_kfold, [](int, const folding::IndexChain& train, const folding::IndexSpan& test) { return train.size() + test.size(); });
+    REQUIRE(sizes == std::vector<size_t>(2, raw.nSamples));
+    REQUIRE_THROWS_AS(folding::ShardedKFold(nFolds, raw.nSamples, seed, { world_size, world_size }), std::invalid_argument);
+    REQUIRE_THROWS_AS(folding::ShardedKFold(nFolds, raw.nSamples, -1, { 0, world_size }), std::invalid_argument);
+}
+TEST_CASE("Multilabel stratified folds", "[Folding]")
+{
+    int seed = GENERATE(17, 42, 57);
+    int nFolds = 5, nSamples = 600, nLabels = 40;
+    // Label l is set with probability 1 / (l + 2), so the last labels are rare
+    auto rng = std::mt19937(seed);
+    auto dense = torch::zeros({ nSamples, nLabels }, torch::kUInt8);
+    auto dense_data = dense.data_ptr<uint8_t>();
+    auto row_offsets = std::vector<int64_t>(1, 0);
+    auto labels = std::vector<int64_t>();
+    for (int sample = 0; sample < nSamples; ++sample) {
+        for (int label = 0; label < nLabels; ++label) {
+            if (rng() % (label + 2) == 0) {
+                dense_data[sample * nLabels + label] = 1;
+                labels.push_back(label);
+            }
+        }
+        row_offsets.push_back(labels.size());
+    }
+    folding::MultilabelStratifiedKFold multilabel_kfold(nFolds, row_offsets, labels, seed);
+    auto fold_ids = multilabel_kfold.getFoldIds();
+    REQUIRE(std::count(fold_ids.begin(), fold_ids.end(), 255) == 0);
+    // Dense and sparse label matrices give the same folds
+    folding::MultilabelStratifiedKFold dense_kfold(nFolds, dense, seed);
+    auto sparse = dense.to_sparse_csr();
+    folding::MultilabelStratifiedKFold sparse_kfold(nFolds, sparse, seed);
+    REQUIRE(dense_kfold.getFoldIds() == fold_ids);
+    REQUIRE(sparse_kfold.getFoldIds() == fold_ids);
+    // Floating matrices too, any non zero value being a label
+    auto floating = dense.to(torch::kFloat);
+    REQUIRE(folding::MultilabelStratifiedKFold(nFolds, floating, seed).getFoldIds() == fold_ids);
+    // Largest difference between the folds in the number of samples of each label
+    auto spreads = [&](const std::vector<uint8_t>& ids) {
+        auto counts = std::vector<std::vector<int>>(nLabels, std::vector<int>(nFolds, 0));
+        for (int sample = 0; sample < nSamples; ++sample) {
+            for (auto entry = row_offsets[sample]; entry < row_offsets[sample + 1]; ++entry) {
+                counts[labels[entry]][ids[sample]]++;
+            }
+        }
+        auto result = std::vector<int>();
+        for (const auto& label_counts : counts) {
+            auto [least, most] = std::minmax_element(label_counts.begin(), label_counts.end());
+            result.push_back(*most - *least);
+        }
+        return result;
+    };
+    auto multilabel_spreads = spreads(fold_ids);
+    folding::KFold kfold(nFolds, nSamples, seed);
+    auto kfold_spreads = spreads(kfold.getFoldIds());
+    // The rarest labels are spread first, evenly, and the labels overall are better spread than with KFold
+    REQUIRE(multilabel_spreads.back() <= 1);
+    REQUIRE(std::accumulate(multilabel_spreads.begin(), multilabel_spreads.end(), 0) < std::accumulate(kfold_spreads.begin(), kfold_spreads.end(), 0));
+    for (int fold = 0; fold < nFolds; ++fold) {
+        REQUIRE(std::abs(static_cast<int>(multilabel_kfold.getFoldView(fold).test.size()) - nSamples / nFolds) <= nSamples / 50);
+    }
+    multilabel_kfold.save("multilabel.folds");
+    auto loaded = folding::MultilabelStratifiedKFold::load("multilabel.folds");
+    REQUIRE(loaded.getFoldIds() == fold_ids);
+    REQUIRE_THROWS_AS(folding::StratifiedKFold::load("multilabel.folds"), std::invalid_argument);
+    std::remove("multilabel.folds");
+    auto bad_offsets = std::vector<int64_t>({ 0, 2, 1 });
+    REQUIRE_THROWS_AS(folding::MultilabelStratifiedKFold(2, bad_offsets, std::vector<int64_t>({ 0, 1 })), std::invalid_argument);
+    auto vector_labels = torch::zeros({ nSamples }, torch::kInt32);
+    REQUIRE_THROWS_WITH(folding::MultilabelStratifiedKFold(nFolds, vector_labels), "The label matrix must have 2 dimensions, not 1");
+}
+#ifdef FOLDING_INSTRUMENTATION
+TEST_CASE("Instrumentation", "[Folding]")
+{
+    std::string file_name = GENERATE("iris", "diabetes", "glass");
+    INFO("File Name: " << file_name);
+    auto raw = RawDatasets(file_name, true);
+    int nFolds = 5;
+    auto events = std::vector<folding::FoldEvent>();
+    folding::setStatsCallback([&events](const folding::FoldEvent& event, const folding::FoldStats&) { events.push_back(event); });
+    // The callback refers to events, so it is removed however the test ends
+    struct CallbackReset {
+        ~CallbackReset() { folding::setStatsCallback(nullptr); }
+    } reset;
+    folding::StratifiedKFold stratified_kfold(nFolds, raw.yt, 17);
+    auto stats = stratified_kfold.getStats();
+    REQUIRE(events.size() == 1);
+    REQUIRE(events[0].kind == folding::FoldEvent::BUILD);
+    REQUIRE(stats.build_bytes >= (raw.nSamples + nFolds + 1) * sizeof(int));
+    REQUIRE(stats.test_sizes.size() == nFolds);
+    REQUIRE(std::accumulate(stats.test_sizes.begin(), stats.test_sizes.end(), int64_t(0)) == raw.nSamples);
+    REQUIRE(stats.size_deviation < 0.05);
+    REQUIRE(stats.class_deviation < 0.05);
+    // Reused vectors only allocate when a fold is larger than the previous ones
+    auto train = std::vector<int>();
+    auto test = std::vector<int>();
+    for (int fold = 0; fold < nFolds; ++fold) {
+        stratified_kfold.getFold(fold, train, test);
+    }
+    stats = stratified_kfold.getStats();
+    REQUIRE(events.size() == nFolds + 1);
+    REQUIRE(events.back().kind == folding::FoldEvent::GET_FOLD);
+    REQUIRE(events.back().fold == nFolds - 1);
+    REQUIRE(stats.fold_calls == nFolds);
+    size_t bytes = 0;
+    for (const auto& event : events) {
+        bytes += event.kind == folding::FoldEvent::GET_FOLD ? event.bytes : 0;
+    }
+    REQUIRE(stats.fold_bytes == bytes);
+    REQUIRE(stats.fold_bytes >= raw.nSamples * sizeof(int));
+    SECTION("Append refreshes the balance")
+    {
+        auto folds = stratified_kfold.append(raw.yv);
+        stats = stratified_kfold.getStats();
+        REQUIRE(std::accumulate(stats.test_sizes.begin(), stats.test_sizes.end(), int64_t(0)) == 2 * raw.nSamples);
+        for (int fold = 0; fold < nFolds; ++fold) {
+            REQUIRE(stats.test_sizes[fold] == static_cast<int64_t>(stratified_kfold.getFold(fold).second.size()));
+        }
+        REQUIRE(stats.build_bytes >= (2 * raw.nSamples + nFolds + 1) * sizeof(int));
+        REQUIRE(stats.size_deviation < 0.05);
+        REQUIRE(stats.class_deviation < 0.05);
+    }
+    SECTION("Random splits are not shuffled to build the statistics")
+    {
+        folding::StratifiedShuffleSplit stratified_shuffle_split(nFolds, raw.yv, 0.25, 17);
+        auto split_stats = stratified_shuffle_split.getStats();
+        REQUIRE(split_stats.test_sizes == std::vector<int64_t>(nFolds, stratified_shuffle_split.getTestSize()));
+        REQUIRE(split_stats.size_deviation == 0);
+        REQUIRE(split_stats.class_deviation < 0.05);
+        REQUIRE(split_stats.build_bytes >= raw.nSamples * sizeof(int));
+        // The class deviation is the one of the splits themselves
+        auto class_sizes = std::map<int, int>();
+        for (auto label : raw.yv) {
+            class_sizes[label]++;
+        }
+        double deviation = 0;
+        for (int split = 0; split < nFolds; ++split) {
+            auto test = stratified_shuffle_split.getFold(split).second;
+            auto counts = std::map<int, int>();
+            for (auto sample : test) {
+                counts[raw.yv[sample]]++;
+            }
+            for (const auto& [label, size] : class_sizes) {
+                deviation = std::max(deviation, std::abs(static_cast<double>(counts[label]) / test.size() - static_cast<double>(size) / raw.nSamples));
+            }
+        }
+        REQUIRE(std::abs(split_stats.class_deviation - deviation) < 1e-12);
+    }
+}
+#endif